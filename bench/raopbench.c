@@ -0,0 +1,741 @@
+/*
+ * RAOP: micro-benchmarks of the audio hot paths
+ *
+ * (c) Philippe, philippe_44@outlook.com
+ *
+ * See LICENSE
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <pthread.h>
+#include <math.h>
+#include <dlfcn.h>
+#include <sys/resource.h>
+
+#include "platform.h"
+#include "cross_ssl.h"
+#include "cross_log.h"
+#include "cross_net.h"
+
+#include "raop_client.h"
+#include "raop_server.h"
+#include "aes_cbc.h"
+#include "alac.h"
+
+// debug level from tools & other elements
+log_level util_loglevel;
+log_level raop_loglevel;
+log_level main_log;
+
+// our debug level
+log_level *loglevel = &main_log;
+
+/*----------------------------------------------------------------------------*/
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*----------------------------------------------------------------------------*/
+static void fill_random(uint8_t *data, size_t len)
+{
+	for (size_t i = 0; i < len; i++) data[i] = rand();
+}
+
+/*----------------------------------------------------------------------------*/
+static int bench_aes(int argc, char *argv[])
+{
+	// default is a 352 frames raw ALAC packet, the usual RAOP payload
+	int packets = 100000, size = DEFAULT_FRAMES_PER_CHUNK * 4 + 8;
+	uint8_t key[16], iv[16], *data;
+	struct {
+		bool accelerated;
+		uint64_t elapsed;
+		const char *name;
+	} runs[] = { { false }, { true } };
+
+	for (int i = 0; i < argc - 1; i++) {
+		if (!strcmp(argv[i], "-n")) packets = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-s")) size = atoi(argv[++i]);
+	}
+
+	data = malloc(size);
+	fill_random(key, sizeof(key));
+	fill_random(iv, sizeof(iv));
+	fill_random(data, size);
+
+	for (int r = 0; r < 2; r++) {
+		aes_cbc_context ctx;
+		uint64_t start;
+
+		if (!aes_cbc_init(&ctx, key, iv, runs[r].accelerated)) {
+			printf("cannot initialize %s AES\n", runs[r].accelerated ? "accelerated" : "reference");
+			continue;
+		}
+
+		runs[r].name = aes_cbc_backend(&ctx);
+
+		// warm-up, then the real thing
+		for (int i = 0; i < 1000; i++) aes_cbc_encrypt(&ctx, data, size);
+
+		start = now_ns();
+		for (int i = 0; i < packets; i++) aes_cbc_encrypt(&ctx, data, size);
+		runs[r].elapsed = now_ns() - start;
+
+		aes_cbc_free(&ctx);
+
+		printf("aes %-4s: %d packets of %d bytes, %.1f ns/packet, %.1f MB/s\n", runs[r].name, packets, size,
+				(double) runs[r].elapsed / packets, (double) packets * size * 1000 / runs[r].elapsed);
+	}
+
+	if (runs[0].elapsed && runs[1].elapsed) {
+		printf("speedup %s/%s: %.2fx\n", runs[1].name, runs[0].name, (double) runs[0].elapsed / runs[1].elapsed);
+	}
+
+	free(data);
+
+	return 0;
+}
+
+/*
+ Minimal ALAC encoder for the decoder benchmark: stereo, no interlacing, the
+ adaptive FIR of the requested order (31 is the delta mode) and the adaptive
+ Rice coding, both mirroring what alac.c expects. Coefficients are not
+ optimized, they start as "repeat last sample" and adapt from there
+*/
+typedef struct {
+	uint8_t *data;
+	int pos;
+} bitwriter_t;
+
+#define BENCH_QUANT	9
+
+/*----------------------------------------------------------------------------*/
+static int clz32(uint32_t value)
+{
+	int n = 0;
+	for (; n < 32 && !(value & 0x80000000); n++) value <<= 1;
+	return n;
+}
+
+/*----------------------------------------------------------------------------*/
+static void put_bits(bitwriter_t *w, uint32_t value, int bits)
+{
+	while (bits--) {
+		if ((value >> bits) & 1) w->data[w->pos >> 3] |= 0x80 >> (w->pos & 7);
+		w->pos++;
+	}
+}
+
+/*----------------------------------------------------------------------------*/
+static void put_rice(bitwriter_t *w, uint32_t value, int k, int sample_size)
+{
+	uint32_t m = (1 << k) - 1, q = k == 1 ? value : value / m, r = k == 1 ? 0 : value % m;
+
+	// escape, 9 ones then the raw value
+	if (q > 8) {
+		put_bits(w, 0x1ff, 9);
+		put_bits(w, value, sample_size);
+		return;
+	}
+
+	put_bits(w, ((1 << q) - 1) << 1, q + 1);
+	if (k == 1) return;
+	// a remainder of 0 is coded on k - 1 bits
+	if (r) put_bits(w, r + 1, k);
+	else put_bits(w, 0, k - 1);
+}
+
+/*----------------------------------------------------------------------------*/
+static void predict(const int32_t *s, int32_t *residual, int frames, int order)
+{
+	int16_t coefs[32] = { 0 };
+
+	residual[0] = s[0];
+	for (int i = 1; i < frames; i++) residual[i] = order ? s[i] - s[i - 1] : s[i];
+	if (!order || order == 31) return;
+
+	coefs[order - 1] = 1 << BENCH_QUANT;
+
+	for (int i = order + 1; i < frames; i++) {
+		int32_t base = s[i - order - 1], sum = 0, error;
+
+		for (int j = 0; j < order; j++) sum += (s[i - 1 - j] - base) * coefs[j];
+		error = residual[i] = s[i] - (((1 << (BENCH_QUANT - 1)) + sum) >> BENCH_QUANT) - base;
+
+		// same adaptation as the decoder
+		for (int j = order - 1; j >= 0 && error; j--) {
+			int32_t val = base - s[i - 1 - j];
+			int sign = (val > 0) - (val < 0);
+			if (error < 0) sign = -sign;
+			coefs[j] -= sign;
+			val *= sign;
+			error -= (val >> BENCH_QUANT) * (order - j);
+			if ((error > 0) != (residual[i] > 0)) break;
+		}
+	}
+}
+
+/*----------------------------------------------------------------------------*/
+static void put_residuals(bitwriter_t *w, const int32_t *residual, int frames, int kmodifier, int historymult, int initialhistory)
+{
+	int history = initialhistory, modifier = 0;
+
+	for (int i = 0; i < frames; i++) {
+		uint32_t coded = residual[i] > 0 ? residual[i] * 2 : -residual[i] * 2 - (residual[i] < 0);
+		int k = 31 - kmodifier - clz32((history >> 9) + 3);
+
+		k = k < 0 ? k + kmodifier : kmodifier;
+		// stereo frames have one extra bit per sample
+		put_rice(w, coded - modifier, k, 17);
+
+		history += coded * historymult - ((history * historymult) >> 9);
+		modifier = 0;
+		if (coded > 0xffff) history = 0xffff;
+
+		// low history means a run of zeros might follow
+		if (history < 128 && i + 1 < frames) {
+			int run = 0;
+			while (i + 1 + run < frames && run < 0xffff && !residual[i + 1 + run]) run++;
+			k = clz32(history) + ((history + 16) / 64) - 24;
+			put_rice(w, run, k, 16);
+			i += run;
+			modifier = 1;
+			history = 0;
+		}
+	}
+}
+
+/*----------------------------------------------------------------------------*/
+static int make_alac_frame(uint8_t *frame, int16_t *pcm, int order, int frames)
+{
+	bitwriter_t w = { frame, 0 };
+	int32_t *s = malloc(frames * sizeof(int32_t)), *residual = malloc(frames * sizeof(int32_t));
+
+	// stereo, compressed, explicit size, no interlacing
+	put_bits(&w, 1, 3);
+	put_bits(&w, 0, 4);
+	put_bits(&w, 0, 12);
+	put_bits(&w, 1, 1);
+	put_bits(&w, 0, 2);
+	put_bits(&w, 0, 1);
+	put_bits(&w, frames, 32);
+	put_bits(&w, 0, 8);
+	put_bits(&w, 0, 8);
+
+	for (int c = 0; c < 2; c++) {
+		// adaptive FIR, rice modifier 4 (i.e. historymult as is)
+		put_bits(&w, 0, 4);
+		put_bits(&w, BENCH_QUANT, 4);
+		put_bits(&w, 4, 3);
+		put_bits(&w, order, 5);
+		for (int i = 0; i < order; i++) put_bits(&w, i == order - 1 && order != 31 ? 1 << BENCH_QUANT : 0, 16);
+	}
+
+	for (int c = 0; c < 2; c++) {
+		int32_t v = 0, level = 0;
+
+		// low-passed noise, predictable enough to look like music to the FIR
+		for (int i = 0; i < frames; i++) {
+			v += rand() % 65 - 32 - v / 32;
+			level += v - level / 128;
+			s[i] = max(min(level, 32767), -32768);
+			pcm[i * 2 + c] = s[i];
+		}
+
+		predict(s, residual, frames, order);
+		put_residuals(&w, residual, frames, 14, 40, 10);
+	}
+
+	free(s);
+	free(residual);
+
+	return (w.pos + 7) / 8;
+}
+
+/*----------------------------------------------------------------------------*/
+static int bench_alac(int argc, char *argv[])
+{
+	int count = 20000, frames = DEFAULT_FRAMES_PER_CHUNK;
+	int orders[] = { 0, 1, 2, 4, 8, 12, 16, 20, 31 };
+	int16_t *pcm, *ref;
+	uint8_t *frame;
+
+	for (int i = 0; i < argc - 1; i++) {
+		if (!strcmp(argv[i], "-n")) count = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-f")) frames = atoi(argv[++i]);
+	}
+
+	frame = malloc(frames * 16 + 1024 + ALAC_INPUT_PADDING);
+	pcm = malloc(frames * 4);
+	ref = malloc(frames * 4);
+
+	for (size_t n = 0; n < sizeof(orders) / sizeof(*orders); n++) {
+		alac_file *alac = create_alac(16, 2);
+		uint64_t elapsed = 0;
+		int size, out;
+
+		// same parameters as RAOP's fmtp
+		alac->setinfo_max_samples_per_frame = frames;
+		alac->setinfo_sample_size = 16;
+		alac->setinfo_rice_historymult = 40;
+		alac->setinfo_rice_initialhistory = 10;
+		alac->setinfo_rice_kmodifier = 14;
+		allocate_buffers(alac);
+
+		memset(frame, 0, frames * 16 + 1024 + ALAC_INPUT_PADDING);
+		size = make_alac_frame(frame, ref, orders[n], frames);
+
+		decode_frame(alac, frame, pcm, &out);
+		if (out != frames * 4 || memcmp(pcm, ref, out)) printf("alac order %2d: decoded frame does not match\n", orders[n]);
+
+		for (int i = 0; i < 100; i++) decode_frame(alac, frame, pcm, &out);
+
+		// best of a few rounds, as a round is short enough to be hit by scheduling
+		for (int r = 0; r < 5; r++) {
+			uint64_t start = now_ns(), round;
+			for (int i = 0; i < count / 5; i++) decode_frame(alac, frame, pcm, &out);
+			round = now_ns() - start;
+			if (!r || round < elapsed) elapsed = round;
+		}
+
+		printf("alac order %2d%s: %d frames of %d samples (%d bytes), %.1f ns/frame, %.2f ns/sample\n",
+				orders[n], orders[n] == 31 ? " (delta)" : "        ", count, frames, size,
+				(double) elapsed / (count / 5), (double) elapsed / (count / 5) / frames);
+
+		delete_alac(alac);
+	}
+
+	free(frame);
+	free(pcm);
+	free(ref);
+
+	return 0;
+}
+
+/*
+ Loopback benchmark: each stream is a player sending to its own in-process
+ server on 127.0.0.1, whose HTTP output is read by a sink. Audio is silence
+ with one marker chunk per second where all bytes have the same value, so it
+ survives any byte swapping and sink can time it end-to-end. Loss and reorder
+ are injected by intercepting sendto and sendmmsg, for audio and re-sent RTP
+ packets only. Stream count doubles at each run up to the maximum
+*/
+#define LOOP_MARKER_GAP	4096		// silent bytes before a marker can be detected
+#define LOOP_BYTE_RATE	(44100 * 4)
+
+typedef struct {
+	struct raopsr_s *sr;
+	struct raopcl_s *cl;
+	pthread_t sender, sink;
+	bool sending, sinking;
+	uint16_t hport;
+	atomic_ullong marks[256];		// send time of each marker value
+	struct {
+		uint64_t count;
+		double sum, sum2;
+	} latency;
+	uint64_t bytes;
+	raop_stats_t stats;
+} loop_stream_t;
+
+static struct {
+	struct in_addr host;
+	bool running, measuring;
+	double loss, reorder;			// percent
+} loop;
+
+// packet held back to be sent after the next one
+static __thread struct {
+	unsigned seed;
+	int fd;
+	size_t len;
+	uint8_t data[2048];
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+} held;
+
+static ssize_t (*real_sendto)(int fd, const void *buf, size_t len, int flags, const struct sockaddr *addr, socklen_t addr_len);
+
+/*----------------------------------------------------------------------------*/
+static bool inject_draw(double percent)
+{
+	if (!held.seed) held.seed = (uintptr_t) &held;
+	return percent > 0 && rand_r(&held.seed) < percent * RAND_MAX / 100;
+}
+
+/*----------------------------------------------------------------------------*/
+static ssize_t inject_send(int fd, const void *buf, size_t len, int flags, const struct sockaddr *addr, socklen_t addr_len)
+{
+	const uint8_t *rtp = buf;
+	int type = len >= 12 && (rtp[0] & 0xc0) == 0x80 ? rtp[1] & 0x7f : 0;
+	ssize_t n;
+
+	if (!real_sendto) real_sendto = dlsym(RTLD_NEXT, "sendto");
+
+	// timing, sync and control packets are left alone
+	if ((!loop.loss && !loop.reorder) || (type != 0x60 && type != 0x56)) return real_sendto(fd, buf, len, flags, addr, addr_len);
+
+	if (inject_draw(loop.loss)) return len;
+
+	if (!held.len && len <= sizeof(held.data) && addr_len <= sizeof(held.addr) && inject_draw(loop.reorder)) {
+		memcpy(held.data, buf, len);
+		if (addr) memcpy(&held.addr, addr, addr_len);
+		held.addr_len = addr ? addr_len : 0;
+		held.fd = fd;
+		held.len = len;
+		return len;
+	}
+
+	n = real_sendto(fd, buf, len, flags, addr, addr_len);
+
+	if (held.len) {
+		real_sendto(held.fd, held.data, held.len, flags, held.addr_len ? (struct sockaddr*) &held.addr : NULL, held.addr_len);
+		held.len = 0;
+	}
+
+	return n;
+}
+
+// glibc's extensions make address a transparent union
+#if defined(__GLIBC__) && defined(__USE_GNU)
+#define SOCKADDR_PTR(addr)	((addr).__sockaddr__)
+#else
+#define __CONST_SOCKADDR_ARG	const struct sockaddr*
+#define SOCKADDR_PTR(addr)	(addr)
+#endif
+
+/*----------------------------------------------------------------------------*/
+ssize_t sendto(int fd, const void *buf, size_t len, int flags, __CONST_SOCKADDR_ARG addr, socklen_t addr_len)
+{
+	return inject_send(fd, buf, len, flags, SOCKADDR_PTR(addr), addr_len);
+}
+
+#if LINUX && defined(__GLIBC__)
+/*----------------------------------------------------------------------------*/
+int sendmmsg(int fd, struct mmsghdr *msgs, unsigned int count, int flags)
+{
+	static int (*real_sendmmsg)(int fd, struct mmsghdr *msgs, unsigned int count, int flags);
+
+	if (!real_sendmmsg) real_sendmmsg = dlsym(RTLD_NEXT, "sendmmsg");
+	if (!loop.loss && !loop.reorder) return real_sendmmsg(fd, msgs, count, flags);
+
+	// player only sends single buffer messages
+	for (unsigned int i = 0; i < count; i++) {
+		struct msghdr *hdr = &msgs[i].msg_hdr;
+		ssize_t n = inject_send(fd, hdr->msg_iov[0].iov_base, hdr->msg_iov[0].iov_len, flags, hdr->msg_name, hdr->msg_namelen);
+		if (n < 0) return i ? (int) i : -1;
+		msgs[i].msg_len = n;
+	}
+
+	return count;
+}
+#endif
+
+/*----------------------------------------------------------------------------*/
+static void *loop_sender(void *arg)
+{
+	loop_stream_t *s = (loop_stream_t*) arg;
+	uint8_t chunk[DEFAULT_FRAMES_PER_CHUNK * 4];
+	uint32_t count = 0;
+	int mark = 0;
+
+	while (loop.running) {
+		uint64_t playtime;
+
+		if (!raopcl_accept_frames(s->cl)) {
+			usleep(1000);
+			continue;
+		}
+
+		// one marker per second, silence otherwise
+		if (count++ % (44100 / DEFAULT_FRAMES_PER_CHUNK) == 0) {
+			mark = mark % 255 + 1;
+			memset(chunk, mark, sizeof(chunk));
+			atomic_store(&s->marks[mark], now_ns());
+		} else if (chunk[0]) memset(chunk, 0, sizeof(chunk));
+
+		raopcl_send_chunk(s->cl, chunk, DEFAULT_FRAMES_PER_CHUNK, &playtime);
+	}
+
+	return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+static void *loop_sink(void *arg)
+{
+	loop_stream_t *s = (loop_stream_t*) arg;
+	struct sockaddr_in addr = { 0 };
+	struct timeval timeout = { 0, 100 * 1000 };
+	char *request = "GET /stream HTTP/1.0\r\n\r\n";
+	uint8_t buf[16384];
+	int sock = socket(AF_INET, SOCK_STREAM, 0), header = 0, zeros = 0;
+
+	addr.sin_family = AF_INET;
+	addr.sin_addr = loop.host;
+	addr.sin_port = htons(s->hport);
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (void*) &timeout, sizeof(timeout));
+
+	if (connect(sock, (struct sockaddr*) &addr, sizeof(addr)) < 0 || send(sock, request, strlen(request), 0) < 0) {
+		LOG_ERROR("[%p]: cannot connect to HTTP port %hu", s, s->hport);
+		closesocket(sock);
+		return NULL;
+	}
+
+	while (s->sinking) {
+		int n = recv(sock, (void*) buf, sizeof(buf), 0), i = 0;
+		uint64_t now = now_ns();
+
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) continue;
+		if (n <= 0) break;
+
+		// skip response headers
+		for (; header < 4 && i < n; i++) header = buf[i] == "\r\n\r\n"[header] ? header + 1 : buf[i] == '\r';
+
+		if (loop.measuring) s->bytes += n - i;
+
+		for (; i < n; i++) {
+			uint64_t sent;
+
+			if (!buf[i]) {
+				zeros++;
+				continue;
+			}
+
+			// first byte of a marker, a lost one is just not measured
+			if (zeros >= LOOP_MARKER_GAP && loop.measuring && (sent = atomic_load(&s->marks[buf[i]])) != 0 && now > sent) {
+				double ms = (now - sent) / 1e6;
+				s->latency.count++;
+				s->latency.sum += ms;
+				s->latency.sum2 += ms * ms;
+			}
+
+			zeros = 0;
+		}
+	}
+
+	closesocket(sock);
+
+	return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+static void loop_raop_cb(void *owner, raopsr_event_t event, ...)
+{
+	loop_stream_t *s = (loop_stream_t*) owner;
+	va_list args;
+
+	// HTTP port is sent again after each flush
+	if (event != RAOP_STREAM || s->sinking) return;
+
+	va_start(args, event);
+	s->hport = va_arg(args, uint32_t);
+	va_end(args);
+
+	s->sinking = true;
+	pthread_create(&s->sink, NULL, loop_sink, s);
+}
+
+/*----------------------------------------------------------------------------*/
+static void loop_close(loop_stream_t *s)
+{
+	if (s->sending) pthread_join(s->sender, NULL);
+
+	if (s->cl) {
+		raopcl_disconnect(s->cl);
+		raopcl_destroy(s->cl);
+	}
+
+	if (s->sinking) {
+		s->sinking = false;
+		pthread_join(s->sink, NULL);
+	}
+
+	raopsr_delete(s->sr);
+}
+
+/*----------------------------------------------------------------------------*/
+static bool loop_run(struct mdnsd *svr, int count, int seconds, int warmup, char *latencies)
+{
+	loop_stream_t *streams = calloc(count, sizeof(loop_stream_t));
+	struct rusage usage[2];
+	struct { uint64_t count; double sum, sum2; } latency = { 0 };
+	uint64_t elapsed, requested = 0, recovered = 0;
+	int created, underruns = 0;
+	double cpu, average, jitter;
+
+	loop.running = true;
+
+	for (created = 0; created < count; created++) {
+		loop_stream_t *s = streams + created;
+		unsigned char mac[6] = { 0x02, 0x00, 0x00, 0x00, created >> 8, created };
+		char name[32];
+
+		snprintf(name, sizeof(name), "raopbench-%d", created);
+		s->sr = raopsr_create(loop.host, svr, name, "raopbench", mac, "pcm", false, false, false, latencies, s,
+							  loop_raop_cb, NULL, 0, 0, 0);
+		if (!s->sr) break;
+
+		s->cl = raopcl_create(loop.host, 0, 0, NULL, NULL, RAOP_ALAC_RAW, DEFAULT_FRAMES_PER_CHUNK, RAOP_LATENCY_MIN,
+							  RAOP_CLEAR, false, NULL, NULL, NULL, NULL, 44100, 16, 2, -144);
+
+		if (!s->cl || !raopcl_connect(s->cl, loop.host, raopsr_get_port(s->sr), false)) {
+			loop_close(s);
+			break;
+		}
+
+		s->sending = true;
+		pthread_create(&s->sender, NULL, loop_sender, s);
+	}
+
+	// let sessions settle, then measure
+	sleep(warmup);
+
+	for (int i = 0; i < created; i++) raopsr_stats(streams[i].sr, &streams[i].stats);
+	getrusage(RUSAGE_SELF, usage);
+	elapsed = now_ns();
+	loop.measuring = true;
+
+	sleep(seconds);
+
+	loop.measuring = false;
+	elapsed = now_ns() - elapsed;
+	getrusage(RUSAGE_SELF, usage + 1);
+
+	for (int i = 0; i < created; i++) {
+		loop_stream_t *s = streams + i;
+		raop_stats_t stats;
+
+		raopsr_stats(s->sr, &stats);
+		s->stats.frames.played = stats.frames.played - s->stats.frames.played;
+		s->stats.frames.silent = stats.frames.silent - s->stats.frames.silent;
+		s->stats.frames.filled = stats.frames.filled - s->stats.frames.filled;
+		requested += stats.frames.requested - s->stats.frames.requested;
+		recovered += stats.frames.recovered - s->stats.frames.recovered;
+	}
+
+	loop.running = false;
+
+	for (int i = 0; i < created; i++) {
+		loop_stream_t *s = streams + i;
+
+		// sink is stopped once closed, so its counters are stable
+		loop_close(s);
+
+		// short of output or too many frames played as silence
+		if ((double) s->bytes * 1e9 / elapsed < LOOP_BYTE_RATE * 0.98 ||
+			(s->stats.frames.silent + s->stats.frames.filled) * 100 > s->stats.frames.played) underruns++;
+
+		latency.count += s->latency.count;
+		latency.sum += s->latency.sum;
+		latency.sum2 += s->latency.sum2;
+	}
+
+	cpu = (usage[1].ru_utime.tv_sec - usage[0].ru_utime.tv_sec + usage[1].ru_stime.tv_sec - usage[0].ru_stime.tv_sec) * 1e6 +
+		  (usage[1].ru_utime.tv_usec - usage[0].ru_utime.tv_usec + usage[1].ru_stime.tv_usec - usage[0].ru_stime.tv_usec);
+	cpu = created ? cpu * 1000 * 100 / elapsed / created : 0;
+
+	average = latency.count ? latency.sum / latency.count : 0;
+	jitter = latency.count ? sqrt(max(latency.sum2 / latency.count - average * average, 0)) : 0;
+
+	printf("loopback %3d/%-3d streams: cpu %.2f%%/stream, latency %.1f ms, jitter %.2f ms (%" PRIu64 " markers), "
+		   "resent %" PRIu64 "/%" PRIu64 ", %d underrun(s)\n", created, count, cpu, average, jitter, latency.count,
+		   recovered, requested, underruns);
+
+	free(streams);
+
+	return created == count && !underruns;
+}
+
+/*----------------------------------------------------------------------------*/
+static int bench_loopback(int argc, char *argv[])
+{
+	int streams = 16, seconds = 10, warmup = 3, supported = 0;
+	char *latencies = "0:0";
+	struct mdnsd *svr;
+	uint32_t mask;
+
+	for (int i = 0; i < argc - 1; i++) {
+		if (!strcmp(argv[i], "-m")) streams = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-t")) seconds = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-w")) warmup = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-l")) loop.loss = atof(argv[++i]);
+		else if (!strcmp(argv[i], "-r")) loop.reorder = atof(argv[++i]);
+		else if (!strcmp(argv[i], "-L")) latencies = argv[++i];
+	}
+
+	netsock_init();
+	loop.host.s_addr = htonl(INADDR_LOOPBACK);
+
+	// servers must register, loopback might not do multicast so use any interface
+	if ((svr = mdnsd_start(loop.host, false)) == NULL) svr = mdnsd_start(get_interface(NULL, NULL, &mask), false);
+
+	if (!svr) {
+		printf("cannot start mDNS responder\n");
+		netsock_close();
+		return -1;
+	}
+
+	for (int n = 1; n <= streams; n = n < streams ? min(n * 2, streams) : n + 1) {
+		if (!loop_run(svr, n, seconds, warmup, latencies)) break;
+		supported = n;
+	}
+
+	printf("loopback: %d concurrent streams without underrun%s (loss %.1f%%, reorder %.1f%%)\n", supported,
+		   supported == streams ? ", maximum tested" : "", loop.loss, loop.reorder);
+
+	mdnsd_stop(svr);
+	netsock_close();
+
+	return 0;
+}
+
+static struct {
+	char *name;
+	int (*run)(int argc, char *argv[]);
+	char *help;
+} modes[] = {
+	{ "aes", bench_aes, "[-n <packets>] [-s <packet size>]: per-packet AES-CBC, accelerated vs aes.c" },
+	{ "alac", bench_alac, "[-n <frames>] [-f <samples per frame>]: ALAC decode cost per predictor order" },
+	{ "loopback", bench_loopback, "[-m <max streams>] [-t <seconds>] [-w <warm-up seconds>] [-l <loss %>] [-r <reorder %>] [-L <latencies>]: "
+								  "player to server on 127.0.0.1, cpu, latency, jitter and streams before underrun" },
+	{ NULL }
+};
+
+/*----------------------------------------------------------------------------*/
+static int print_usage(char *name)
+{
+	printf("usage: %s <mode> [options]\n", name);
+	for (int i = 0; modes[i].name; i++) printf("\t%s %s\n", modes[i].name, modes[i].help);
+	return -1;
+}
+
+/*----------------------------------------------------------------------------*/
+int main(int argc, char *argv[])
+{
+	int rc = -1;
+
+	if (argc < 2) return print_usage(argv[0]);
+
+	cross_ssl_load();
+	srand(0x5eed);
+
+	for (int i = 0; modes[i].name; i++) {
+		if (strcmp(argv[1], modes[i].name)) continue;
+		rc = modes[i].run(argc - 2, argv + 2);
+		break;
+	}
+
+	cross_ssl_free();
+
+	return rc == -1 ? print_usage(argv[0]) : rc;
+}
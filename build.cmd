@@ -19,6 +19,9 @@ robocopy lib\win32\x86 %target% lib*.lib lib*.pdb /NDL /NJH /NJS /nc /ns /np
 robocopy src targets\include raop_client.h /NDL /NJH /NJS /nc /ns /np
 robocopy src targets\include raop_server.h /NDL /NJH /NJS /nc /ns /np
 robocopy src targets\include raop_streamer.h /NDL /NJH /NJS /nc /ns /np
+robocopy src targets\include raop_reactor.h /NDL /NJH /NJS /nc /ns /np
+robocopy src targets\include raop_cache.h /NDL /NJH /NJS /nc /ns /np
+robocopy src targets\include raop_hist.h /NDL /NJH /NJS /nc /ns /np
 
 endlocal
 
@@ -102,6 +102,9 @@ do
 		cp -u src/raop_client.h targets/include
 		cp -u src/raop_server.h targets/include
 		cp -u src/raop_streamer.h targets/include
+		cp -u src/raop_reactor.h targets/include
+		cp -u src/raop_cache.h targets/include
+		cp -u src/raop_hist.h targets/include
 	else
 		rm -f $target/lib$item.a
 	fi
@@ -0,0 +1,72 @@
+/*
+ * RAOP: AES-128-CBC for RTP payloads
+ *
+ * (c) Philippe, philippe_44@outlook.com
+ *
+ * See LICENSE
+ *
+ */
+
+#include <string.h>
+#include <openssl/evp.h>
+
+#include "aes_cbc.h"
+
+/*----------------------------------------------------------------------------*/
+bool aes_cbc_init(aes_cbc_context *ctx, uint8_t *key, uint8_t *iv, bool accelerated)
+{
+	memset(ctx, 0, sizeof(aes_cbc_context));
+	memcpy(ctx->iv, iv, sizeof(ctx->iv));
+
+	// always ready for fallback
+	aes_set_key(&ctx->aes, key, 128);
+
+	if (!accelerated) return true;
+
+	if ((ctx->evp = EVP_CIPHER_CTX_new()) == NULL) return false;
+
+	// no padding, caller only gives full blocks
+	if (!EVP_EncryptInit_ex(ctx->evp, EVP_aes_128_cbc(), NULL, key, iv) ||
+		!EVP_CIPHER_CTX_set_padding(ctx->evp, 0)) {
+		EVP_CIPHER_CTX_free(ctx->evp);
+		ctx->evp = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+/*----------------------------------------------------------------------------*/
+void aes_cbc_free(aes_cbc_context *ctx)
+{
+	if (ctx->evp) EVP_CIPHER_CTX_free(ctx->evp);
+	ctx->evp = NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+const char *aes_cbc_backend(aes_cbc_context *ctx)
+{
+	return ctx->evp ? "evp" : "aes";
+}
+
+/*----------------------------------------------------------------------------*/
+int aes_cbc_encrypt(aes_cbc_context *ctx, uint8_t *data, int size)
+{
+	uint8_t *nv = ctx->iv;
+	int i, j, len = size & ~15;
+
+	if (ctx->evp) {
+		// same cipher and key, just reset the IV and encrypt in place
+		if (EVP_EncryptInit_ex(ctx->evp, NULL, NULL, NULL, ctx->iv) &&
+			EVP_EncryptUpdate(ctx->evp, data, &i, data, len)) return i;
+	}
+
+	for (i = 0; i < len; i += 16) {
+		uint8_t *buf = data + i;
+		for (j = 0; j < 16; j++) buf[j] ^= nv[j];
+		aes_encrypt(&ctx->aes, buf, buf);
+		nv = buf;
+	}
+
+	return len;
+}
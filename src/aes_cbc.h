@@ -0,0 +1,34 @@
+/*
+ * RAOP: AES-128-CBC for RTP payloads
+ *
+ * (c) Philippe, philippe_44@outlook.com
+ *
+ * See LICENSE
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "aes.h"
+
+/*
+ Each call to aes_cbc_encrypt restarts from the initial IV (that's how RAOP
+ encrypts every RTP packet) and only full 16 bytes blocks are encrypted, the
+ remaining bytes are left in clear. OpenSSL's EVP is used when available, so
+ that AES-NI or ARMv8 crypto extensions are used, otherwise it falls back to the
+ byte-oriented aes.c
+*/
+
+typedef struct {
+	uint8_t iv[16];
+	void *evp;
+	aes_context aes;
+} aes_cbc_context;
+
+bool 		aes_cbc_init(aes_cbc_context *ctx, uint8_t *key, uint8_t *iv, bool accelerated);
+void 		aes_cbc_free(aes_cbc_context *ctx);
+int 		aes_cbc_encrypt(aes_cbc_context *ctx, uint8_t *data, int size);
+const char*	aes_cbc_backend(aes_cbc_context *ctx);
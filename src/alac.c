@@ -167,36 +167,52 @@ static uint32_t readbits(alac_file *alac, int bits)
     return result;
 }
 
-/* reads a single bit */
-static int readbit(alac_file *alac)
+/* cached window reader, used by the entropy decoder which is where most of
+ * the bits are read. The position is a bit offset from a byte pointer and
+ * every peek loads 64 bits at once, so at least 57 bits are always available.
+ * This means it can read up to ALAC_INPUT_PADDING bytes past the frame
+ */
+#if defined(__GNUC__)
+#define bswap64(v) __builtin_bswap64(v)
+#define clz64(v) __builtin_clzll(v)
+#elif defined(_MSC_VER)
+#include <intrin.h>
+#define bswap64(v) _byteswap_uint64(v)
+static int clz64(uint64_t v)
 {
-    int result;
-    int new_accumulator;
-
-    result = alac->input_buffer[0];
-
-    result = result << alac->input_buffer_bitaccumulator;
-
-    result = result >> 7 & 1;
-
-    new_accumulator = (alac->input_buffer_bitaccumulator + 1);
-
-    alac->input_buffer += (new_accumulator / 8);
-
-    alac->input_buffer_bitaccumulator = (new_accumulator % 8);
-
-    return result;
+    unsigned long index;
+#if defined(_M_X64) || defined(_M_ARM64)
+    _BitScanReverse64(&index, v);
+    return 63 - index;
+#else
+    if (_BitScanReverse(&index, (uint32_t) (v >> 32))) return 31 - index;
+    _BitScanReverse(&index, (uint32_t) v);
+    return 63 - index;
+#endif
 }
+#else
+static uint64_t bswap64(uint64_t v)
+{
+    v = ((v & 0x00ff00ff00ff00ffULL) << 8) | ((v >> 8) & 0x00ff00ff00ff00ffULL);
+    v = ((v & 0x0000ffff0000ffffULL) << 16) | ((v >> 16) & 0x0000ffff0000ffffULL);
+    return (v << 32) | (v >> 32);
+}
+static int clz64(uint64_t v)
+{
+    int n = 0;
+    while (!(v & 0x8000000000000000ULL)) { n++; v <<= 1; }
+    return n;
+}
+#endif
 
-static void unreadbits(alac_file *alac, int bits)
+static inline uint64_t peekbits_64(const unsigned char *buffer, int pos)
 {
-    int new_accumulator = (alac->input_buffer_bitaccumulator - bits);
+    uint64_t window;
 
-    alac->input_buffer += (new_accumulator >> 3);
+    memcpy(&window, buffer + (pos >> 3), sizeof(window));
+    if (!host_bigendian) window = bswap64(window);
 
-    alac->input_buffer_bitaccumulator = (new_accumulator & 7);
-    if (alac->input_buffer_bitaccumulator < 0)
-        alac->input_buffer_bitaccumulator *= -1;
+    return window << (pos & 7);
 }
 
 /* various implementations of count_leading_zero:
@@ -226,7 +242,8 @@ static int count_leading_zeros(int32_t input)
  */
 static int count_leading_zeros(int input)
 {
-    return __builtin_clz(input);
+    // __builtin_clz(0) is undefined but history can be 0
+    return input ? __builtin_clz(input) : 32;
 }
 #elif (defined(_MSC_VER) || defined (__BORLANDC__)) && defined(_M_IX86)
 static int count_leading_zeros(int input)
@@ -292,45 +309,45 @@ found:
 
 #define RICE_THRESHOLD 8 // maximum number of bits for a rice prefix.
 
-static int32_t entropy_decode_value(alac_file* alac,
-                             int readSampleSize,
-							 int k,
-                             int rice_kmodifier_mask)
+/* a value is a unary prefix of up to RICE_THRESHOLD 1s ended by a 0, then
+ * k bits, or RICE_THRESHOLD + 1 1s followed by an escaped raw value. Worst
+ * case is RICE_THRESHOLD + 1 + 32 bits, so one window is always enough
+ */
+static inline int32_t entropy_decode_value(const unsigned char *buffer,
+                                           int *pos,
+                                           int readSampleSize,
+                                           int k,
+                                           int rice_kmodifier_mask)
 {
-    int32_t x = 0; // decoded value
-
-    // read x, number of 1s before 0 represent the rice value.
-    while (x <= RICE_THRESHOLD && readbit(alac))
-    {
-        x++;
-    }
+    uint64_t window = peekbits_64(buffer, *pos);
+    // count leading 1s, with a stop so that it never goes beyond the escape
+    int32_t x = clz64(~window | (1ULL << (63 - (RICE_THRESHOLD + 1))));
 
     if (x > RICE_THRESHOLD)
     {
-        // read the number from the bit stream (raw value)
-        int32_t value;
-
-        value = readbits(alac, readSampleSize);
+        // read the number from the bit stream (raw value), already masked
+        window <<= x;
+        *pos += x + readSampleSize;
+        return readSampleSize ? (int32_t) (window >> (64 - readSampleSize)) : 0;
+    }
 
-        // mask value
-        value &= (((uint32_t)0xffffffff) >> (32 - readSampleSize));
+    // skip the terminating 0
+    *pos += x + 1;
 
-        x = value;
-    }
-    else
+    if (k != 1)
     {
-        if (k != 1)
-        {
-            int extraBits = readbits(alac, k);
+        uint32_t extraBits = k ? (window << (x + 1)) >> (64 - k) : 0;
 
-            // x = x * (2^k - 1)
-            x *= (((1 << k) - 1) & rice_kmodifier_mask);
+        // x = x * (2^k - 1)
+        x *= (((1 << k) - 1) & rice_kmodifier_mask);
 
-            if (extraBits > 1)
-                x += extraBits - 1;
-            else
-                unreadbits(alac, 1);
+        // last bit was not part of the value unless extraBits > 1
+        if (extraBits > 1)
+        {
+            x += extraBits - 1;
+            *pos += k;
         }
+        else *pos += k - 1;
     }
 
     return x;
@@ -348,6 +365,8 @@ static void entropy_rice_decode(alac_file* alac,
     int             outputCount;
     int             history = rice_initialhistory;
     int             signModifier = 0;
+    const unsigned char *buffer = alac->input_buffer;
+    int             pos = alac->input_buffer_bitaccumulator;
 
     for (outputCount = 0; outputCount < outputSize; outputCount++)
     {
@@ -361,7 +380,7 @@ static void entropy_rice_decode(alac_file* alac,
         else k = rice_kmodifier;
 
         // note: don't use rice_kmodifier_mask here (set mask to 0xFFFFFFFF)
-        decodedValue = entropy_decode_value(alac, readSampleSize, k, 0xFFFFFFFF);
+        decodedValue = entropy_decode_value(buffer, &pos, readSampleSize, k, 0xFFFFFFFF);
 
         decodedValue += signModifier;
         finalValue = (decodedValue + 1) / 2; // inc by 1 and shift out sign bit
@@ -389,12 +408,13 @@ static void entropy_rice_decode(alac_file* alac,
             k = count_leading_zeros(history) + ((history + 16) / 64) - 24;
 
 			// note: blockSize is always 16bit
-            blockSize = entropy_decode_value(alac, 16, k, rice_kmodifier_mask);
+            blockSize = entropy_decode_value(buffer, &pos, 16, k, rice_kmodifier_mask);
 
-            // got blockSize 0s
+            // got blockSize 0s (never beyond the output, frame is corrupted)
             if (blockSize > 0)
             {
-                memset(&outputBuffer[outputCount + 1], 0, blockSize * sizeof(*outputBuffer));
+                int count = blockSize < outputSize - outputCount - 1 ? blockSize : outputSize - outputCount - 1;
+                memset(&outputBuffer[outputCount + 1], 0, count * sizeof(*outputBuffer));
                 outputCount += blockSize;
             }
 
@@ -404,6 +424,10 @@ static void entropy_rice_decode(alac_file* alac,
             history = 0;
         }
     }
+
+    // and give the position back to the regular reader
+    alac->input_buffer += pos >> 3;
+    alac->input_buffer_bitaccumulator = pos & 7;
 }
 
 #define SIGN_EXTENDED32(val, bits) ((val << (32 - bits)) >> (32 - bits))
@@ -413,6 +437,98 @@ static void entropy_rice_decode(alac_file* alac,
                                 ((v > 0) ? (1) : \
                                            (0)))
 
+/* the adaptive FIR filter for a given order, meant to be inlined with a
+ * constant one. The compiler can then fully unroll it and keep the last
+ * samples and the coefficients in registers instead of going back to memory
+ * for every product. The unrolled adaptation still stops as soon as the error
+ * changes sign, exactly like the general case
+ */
+#if defined(__GNUC__)
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#define UNROLL _Pragma("GCC unroll 32")
+#elif defined(_MSC_VER)
+#define ALWAYS_INLINE __forceinline
+#define UNROLL
+#else
+#define ALWAYS_INLINE inline
+#define UNROLL
+#endif
+
+static ALWAYS_INLINE void fir_adapt_order(const int32_t *error_buffer,
+                                          int32_t *buffer_out,
+                                          int output_size,
+                                          int readsamplesize,
+                                          int16_t *predictor_coef_table,
+                                          const int predictor_coef_num,
+                                          int predictor_quantitization)
+{
+    int16_t coefs[32];
+    int32_t history[32 + 1];
+    int i, j;
+
+    /* local copies, so that they can't alias the output */
+    memcpy(coefs, predictor_coef_table, predictor_coef_num * sizeof(int16_t));
+    memcpy(history, buffer_out, (predictor_coef_num + 1) * sizeof(int32_t));
+
+    for (i = predictor_coef_num + 1; i < output_size; i++)
+    {
+        int sum = 0;
+        int outval;
+        int base = history[0];
+        int error_val = error_buffer[i];
+
+        UNROLL
+        for (j = 0; j < predictor_coef_num; j++)
+        {
+            sum += (history[predictor_coef_num-j] - base) * coefs[j];
+        }
+
+        outval = (1 << (predictor_quantitization-1)) + sum;
+        outval = outval >> predictor_quantitization;
+        outval = outval + base + error_val;
+        outval = SIGN_EXTENDED32(outval, readsamplesize);
+
+        buffer_out[i] = outval;
+
+        if (error_val > 0)
+        {
+            UNROLL
+            for (j = predictor_coef_num - 1; j >= 0 && error_val > 0; j--)
+            {
+                int val = base - history[predictor_coef_num - j];
+                int sign = SIGN_ONLY(val);
+
+                coefs[j] -= sign;
+                error_val -= (((val * sign) >> predictor_quantitization) *
+                              (predictor_coef_num - j));
+            }
+        }
+        else if (error_val < 0)
+        {
+            UNROLL
+            for (j = predictor_coef_num - 1; j >= 0 && error_val < 0; j--)
+            {
+                int val = base - history[predictor_coef_num - j];
+                int sign = - SIGN_ONLY(val);
+
+                coefs[j] -= sign;
+                error_val -= (((val * sign) >> predictor_quantitization) *
+                              (predictor_coef_num - j));
+            }
+        }
+
+        /* slide the window, these are just register renames once unrolled */
+        UNROLL
+        for (j = 0; j < predictor_coef_num; j++)
+        {
+            history[j] = history[j + 1];
+        }
+        history[predictor_coef_num] = outval;
+    }
+
+    memcpy(predictor_coef_table, coefs, predictor_coef_num * sizeof(int16_t));
+}
+
 static void predictor_decompress_fir_adapt(int32_t *error_buffer,
                                            int32_t *buffer_out,
                                            int output_size,
@@ -437,15 +553,12 @@ static void predictor_decompress_fir_adapt(int32_t *error_buffer,
     { /* second-best case scenario for fir decompression,
 	   * error describes a small difference from the previous sample only
        */
-        if (output_size <= 1) return;
-        for (i = 0; i < output_size - 1; i++)
-        {
-            int32_t prev_value;
-            int32_t error_value;
+        int32_t prev_value = buffer_out[0];
 
-            prev_value = buffer_out[i];
-            error_value = error_buffer[i+1];
-            buffer_out[i+1] = SIGN_EXTENDED32((prev_value + error_value), readsamplesize);
+        for (i = 1; i < output_size; i++)
+        {
+            prev_value = SIGN_EXTENDED32((prev_value + error_buffer[i]), readsamplesize);
+            buffer_out[i] = prev_value;
         }
         return;
     }
@@ -466,22 +579,27 @@ static void predictor_decompress_fir_adapt(int32_t *error_buffer,
         }
     }
 
-#if 0
-    /* 4 and 8 are very common cases (the only ones i've seen). these
-     * should be unrolled and optimised
-     */
+    /* 4 and 8 are the orders picked by the Apple encoder, 16 is a cheap extra */
     if (predictor_coef_num == 4)
     {
-        /* FIXME: optimised general case */
+        fir_adapt_order(error_buffer, buffer_out, output_size, readsamplesize,
+                        predictor_coef_table, 4, predictor_quantitization);
         return;
     }
 
-    if (predictor_coef_table == 8)
+    if (predictor_coef_num == 8)
     {
-        /* FIXME: optimised general case */
+        fir_adapt_order(error_buffer, buffer_out, output_size, readsamplesize,
+                        predictor_coef_table, 8, predictor_quantitization);
+        return;
+    }
+
+    if (predictor_coef_num == 16)
+    {
+        fir_adapt_order(error_buffer, buffer_out, output_size, readsamplesize,
+                        predictor_coef_table, 16, predictor_quantitization);
         return;
     }
-#endif
 
 
     /* general case */
@@ -3,6 +3,11 @@
 
 typedef struct alac_file alac_file;
 
+/* decoder might read up to that many bytes after the end of the frame, so
+ * input buffer must be larger by at least that amount
+ */
+#define ALAC_INPUT_PADDING 8
+
 alac_file *create_alac(int samplesize, int numchannels);
 void delete_alac(alac_file *alac);
 void decode_frame(alac_file *alac,
@@ -0,0 +1,246 @@
+/*
+ * RAOP: PCM packing kernels (byte-swap and raw ALAC)
+ *
+ * (c) Philippe, philippe_44@outlook.com
+ *
+ * See LICENSE
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "platform.h"
+#include "pcm_pack.h"
+
+#include "cross_log.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PCM_PACK_X86
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#define PCM_PACK_NEON
+#include <arm_neon.h>
+#endif
+
+extern log_level	raop_loglevel;
+static log_level 	*loglevel = &raop_loglevel;
+
+typedef void (*pcm_kernel_t)(uint8_t *dst, const uint8_t *src, size_t count);
+
+static struct {
+	const char *name;
+	pcm_kernel_t swap16, alac_words;
+} backend = { "scalar", pcm_swap16_ref, pcm_alac_words_ref };
+
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+/*----------------------------------------------------------------------------*/
+void pcm_swap16_ref(uint8_t *dst, const uint8_t *src, size_t frames)
+{
+	for (size_t i = 0; i < frames * 2; i++, src += 2) {
+		*dst++ = src[1];
+		*dst++ = src[0];
+	}
+}
+
+/*----------------------------------------------------------------------------*/
+void pcm_alac_words_ref(uint8_t *dst, const uint8_t *src, size_t count)
+{
+	for (size_t i = 0; i < count; i++, src += 2) {
+		uint16_t s = src[0] | (src[1] << 8);
+		uint16_t next = i + 1 < count ? src[2] | (src[3] << 8) : 0;
+		uint16_t w = (s << 1) | (next >> 15);
+		*dst++ = w >> 8;
+		*dst++ = w;
+	}
+}
+
+#if defined(PCM_PACK_X86)
+
+/*
+ Next sample is an unaligned load 2 bytes later, so vector loops must stop
+ before the last sample and let the reference do the tail
+*/
+
+/*----------------------------------------------------------------------------*/
+__attribute__((target("sse2")))
+static void pcm_swap16_sse2(uint8_t *dst, const uint8_t *src, size_t frames)
+{
+	size_t i = 0, bytes = frames * 4;
+
+	for (; i + 16 <= bytes; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*) (src + i));
+		v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+		_mm_storeu_si128((__m128i*) (dst + i), v);
+	}
+
+	pcm_swap16_ref(dst + i, src + i, (bytes - i) / 4);
+}
+
+/*----------------------------------------------------------------------------*/
+__attribute__((target("sse2")))
+static void pcm_alac_words_sse2(uint8_t *dst, const uint8_t *src, size_t count)
+{
+	size_t i = 0;
+
+	for (; i + 8 < count; i += 8) {
+		__m128i v = _mm_loadu_si128((const __m128i*) (src + i * 2));
+		__m128i n = _mm_loadu_si128((const __m128i*) (src + i * 2 + 2));
+		__m128i w = _mm_or_si128(_mm_slli_epi16(v, 1), _mm_srli_epi16(n, 15));
+		w = _mm_or_si128(_mm_slli_epi16(w, 8), _mm_srli_epi16(w, 8));
+		_mm_storeu_si128((__m128i*) (dst + i * 2), w);
+	}
+
+	pcm_alac_words_ref(dst + i * 2, src + i * 2, count - i);
+}
+
+/*----------------------------------------------------------------------------*/
+__attribute__((target("avx2")))
+static void pcm_swap16_avx2(uint8_t *dst, const uint8_t *src, size_t frames)
+{
+	size_t i = 0, bytes = frames * 4;
+	const __m256i mask = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+										  1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+
+	for (; i + 32 <= bytes; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i*) (src + i));
+		_mm256_storeu_si256((__m256i*) (dst + i), _mm256_shuffle_epi8(v, mask));
+	}
+
+	pcm_swap16_sse2(dst + i, src + i, (bytes - i) / 4);
+}
+
+/*----------------------------------------------------------------------------*/
+__attribute__((target("avx2")))
+static void pcm_alac_words_avx2(uint8_t *dst, const uint8_t *src, size_t count)
+{
+	size_t i = 0;
+	const __m256i mask = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+										  1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+
+	for (; i + 16 < count; i += 16) {
+		__m256i v = _mm256_loadu_si256((const __m256i*) (src + i * 2));
+		__m256i n = _mm256_loadu_si256((const __m256i*) (src + i * 2 + 2));
+		__m256i w = _mm256_or_si256(_mm256_slli_epi16(v, 1), _mm256_srli_epi16(n, 15));
+		_mm256_storeu_si256((__m256i*) (dst + i * 2), _mm256_shuffle_epi8(w, mask));
+	}
+
+	pcm_alac_words_sse2(dst + i * 2, src + i * 2, count - i);
+}
+
+#elif defined(PCM_PACK_NEON)
+
+/*----------------------------------------------------------------------------*/
+static void pcm_swap16_neon(uint8_t *dst, const uint8_t *src, size_t frames)
+{
+	size_t i = 0, bytes = frames * 4;
+
+	for (; i + 16 <= bytes; i += 16) {
+		vst1q_u8(dst + i, vrev16q_u8(vld1q_u8(src + i)));
+	}
+
+	pcm_swap16_ref(dst + i, src + i, (bytes - i) / 4);
+}
+
+/*----------------------------------------------------------------------------*/
+static void pcm_alac_words_neon(uint8_t *dst, const uint8_t *src, size_t count)
+{
+	size_t i = 0;
+
+	for (; i + 8 < count; i += 8) {
+		uint16x8_t v = vreinterpretq_u16_u8(vld1q_u8(src + i * 2));
+		uint16x8_t n = vreinterpretq_u16_u8(vld1q_u8(src + i * 2 + 2));
+		uint16x8_t w = vorrq_u16(vshlq_n_u16(v, 1), vshrq_n_u16(n, 15));
+		vst1q_u8(dst + i * 2, vrev16q_u8(vreinterpretq_u8_u16(w)));
+	}
+
+	pcm_alac_words_ref(dst + i * 2, src + i * 2, count - i);
+}
+
+#endif
+
+/*----------------------------------------------------------------------------*/
+static bool _pcm_pack_check(pcm_kernel_t swap16, pcm_kernel_t alac_words)
+{
+	// odd sizes on purpose so that tails are exercised as well
+	uint8_t src[4 * 67], ref[4 * 67], out[4 * 67];
+	bool ok = true;
+
+	for (size_t i = 0; i < sizeof(src); i++) src[i] = (i * 151 + 7) ^ (i >> 3);
+
+	for (size_t frames = 0; frames <= 67 && ok; frames += 1) {
+		pcm_swap16_ref(ref, src, frames);
+		swap16(out, src, frames);
+		ok &= !memcmp(ref, out, frames * 4);
+
+		pcm_alac_words_ref(ref, src, frames * 2);
+		alac_words(out, src, frames * 2);
+		ok &= !memcmp(ref, out, frames * 4);
+	}
+
+	return ok;
+}
+
+/*----------------------------------------------------------------------------*/
+static void _pcm_pack_select(void)
+{
+	const char *name = NULL;
+	pcm_kernel_t swap16 = NULL, alac_words = NULL;
+
+#if defined(PCM_PACK_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		name = "avx2";
+		swap16 = pcm_swap16_avx2;
+		alac_words = pcm_alac_words_avx2;
+	} else if (__builtin_cpu_supports("sse2")) {
+		name = "sse2";
+		swap16 = pcm_swap16_sse2;
+		alac_words = pcm_alac_words_sse2;
+	}
+#elif defined(PCM_PACK_NEON)
+	name = "neon";
+	swap16 = pcm_swap16_neon;
+	alac_words = pcm_alac_words_neon;
+#endif
+
+	if (name && !_pcm_pack_check(swap16, alac_words)) {
+		LOG_ERROR("PCM packing %s does not match reference, using scalar", name);
+		name = NULL;
+	}
+
+	if (name) {
+		backend.name = name;
+		backend.swap16 = swap16;
+		backend.alac_words = alac_words;
+	}
+
+	LOG_INFO("PCM packing using %s", backend.name);
+}
+
+/*----------------------------------------------------------------------------*/
+void pcm_pack_init(void)
+{
+	pthread_once(&once, _pcm_pack_select);
+}
+
+/*----------------------------------------------------------------------------*/
+const char *pcm_pack_backend(void)
+{
+	return backend.name;
+}
+
+/*----------------------------------------------------------------------------*/
+void pcm_swap16(uint8_t *dst, const uint8_t *src, size_t frames)
+{
+	backend.swap16(dst, src, frames);
+}
+
+/*----------------------------------------------------------------------------*/
+void pcm_alac_words(uint8_t *dst, const uint8_t *src, size_t count)
+{
+	backend.alac_words(dst, src, count);
+}
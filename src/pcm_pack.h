@@ -0,0 +1,32 @@
+/*
+ * RAOP: PCM packing kernels (byte-swap and raw ALAC)
+ *
+ * (c) Philippe, philippe_44@outlook.com
+ *
+ * See LICENSE
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ All kernels take 16 bits little-endian stereo samples. The best implementation
+ for the CPU (AVX2, SSE2, NEON or scalar) is selected once, at the first call
+ of pcm_pack_init(), and verified against the scalar reference.
+
+ - pcm_swap16 writes 16 bits big-endian samples (4 bytes per frame)
+ - pcm_alac_words writes, for each of the 'count' 16 bits samples, the 16 bits
+   big-endian word (s[i] << 1) | (s[i+1] >> 15) where s[count] is 0. This is the
+   body of an uncompressed ALAC frame which is off by one bit
+*/
+
+void 		pcm_pack_init(void);
+const char*	pcm_pack_backend(void);
+void 		pcm_swap16(uint8_t *dst, const uint8_t *src, size_t frames);
+void 		pcm_alac_words(uint8_t *dst, const uint8_t *src, size_t count);
+
+void 		pcm_swap16_ref(uint8_t *dst, const uint8_t *src, size_t frames);
+void 		pcm_alac_words_ref(uint8_t *dst, const uint8_t *src, size_t count);
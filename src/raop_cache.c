@@ -0,0 +1,242 @@
+/*
+ * RAOP: HTTP replay cache
+ *
+ * (c) Philippe, philippe_44@outlook.com
+ *
+ * See LICENSE
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "platform.h"
+#include "raop_cache.h"
+
+#include "cross_log.h"
+
+#if !WIN
+#include <sys/mman.h>
+#endif
+
+#define CACHE_FRAME_MIN	256		// average frame size below which oldest frames are not indexed
+
+extern log_level	raop_loglevel;
+static log_level 	*loglevel = &raop_loglevel;
+
+typedef struct raop_cache_pool_s {
+	raop_cache_backend_t backend;
+	size_t size;
+	int count;
+	uint8_t *base;
+	bool *used;
+	pthread_mutex_t mutex;
+} raop_cache_pool_t;
+
+/*
+ Frames are numbered from reset and their start offset is in a ring. Oldest is
+ the first frame that is still indexed and entirely in the data ring, it only
+ moves forward when frames are written
+*/
+typedef struct raop_cache_s {
+	raop_cache_pool_t *pool;
+	int slot;
+	uint8_t *data;
+	size_t size, count;
+	struct {
+		size_t *starts;
+		uint32_t frames, next, oldest;
+	} index;
+} raop_cache_t;
+
+/*----------------------------------------------------------------------------*/
+struct raop_cache_pool_s *raop_cache_pool_create(raop_cache_backend_t backend, char *dir, size_t size, int count)
+{
+	raop_cache_pool_t *pool;
+
+	if (!size || count <= 0) return NULL;
+
+	pool = malloc(sizeof(raop_cache_pool_t));
+	memset(pool, 0, sizeof(raop_cache_pool_t));
+	pool->size = size;
+	pool->count = count;
+
+#if !WIN
+	if (backend == RAOP_CACHE_FILE) {
+		char path[256];
+		int fd;
+
+		snprintf(path, sizeof(path), "%s/raopcacheXXXXXX", dir ? dir : "/dev/shm");
+
+		// file only exists through mapping
+		if ((fd = mkstemp(path)) >= 0) {
+			unlink(path);
+			if (!ftruncate(fd, size * count)) {
+				pool->base = mmap(NULL, size * count, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+				if (pool->base == MAP_FAILED) pool->base = NULL;
+			}
+			close(fd);
+		}
+
+		if (!pool->base) LOG_WARN("[%p]: cannot map cache file in %s (%s), using memory", pool, path, strerror(errno));
+		else pool->backend = RAOP_CACHE_FILE;
+	}
+#else
+	if (backend == RAOP_CACHE_FILE) LOG_WARN("[%p]: no cache file on this platform, using memory", pool);
+#endif
+
+	if (!pool->base && (pool->base = malloc(size * count)) == NULL) {
+		LOG_ERROR("[%p]: cannot allocate cache pool of %d x %zu bytes", pool, count, size);
+		free(pool);
+		return NULL;
+	}
+
+	pool->used = calloc(count, sizeof(bool));
+	pthread_mutex_init(&pool->mutex, NULL);
+
+	LOG_INFO("[%p]: cache pool of %d x %zu bytes in %s", pool, count, size, pool->backend == RAOP_CACHE_FILE ? "file" : "memory");
+
+	return pool;
+}
+
+/*----------------------------------------------------------------------------*/
+void raop_cache_pool_destroy(struct raop_cache_pool_s *pool)
+{
+	if (!pool) return;
+
+	for (int i = 0; i < pool->count; i++) {
+		if (pool->used[i]) LOG_WARN("[%p]: cache %d still in use", pool, i);
+	}
+
+#if !WIN
+	if (pool->backend == RAOP_CACHE_FILE) munmap(pool->base, pool->size * pool->count);
+	else free(pool->base);
+#else
+	free(pool->base);
+#endif
+
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool->used);
+	free(pool);
+}
+
+/*----------------------------------------------------------------------------*/
+struct raop_cache_s *raop_cache_create(struct raop_cache_pool_s *pool)
+{
+	raop_cache_t *cache = malloc(sizeof(raop_cache_t));
+
+	memset(cache, 0, sizeof(raop_cache_t));
+	cache->slot = -1;
+
+	if (pool) {
+		pthread_mutex_lock(&pool->mutex);
+		for (int i = 0; i < pool->count; i++) {
+			if (pool->used[i]) continue;
+			pool->used[i] = true;
+			cache->pool = pool;
+			cache->slot = i;
+			cache->size = pool->size;
+			cache->data = pool->base + i * pool->size;
+			break;
+		}
+		pthread_mutex_unlock(&pool->mutex);
+		if (!cache->pool) LOG_WARN("[%p]: cache pool exhausted, allocating", pool);
+	}
+
+	if (!cache->data) {
+		cache->size = RAOP_CACHE_SIZE;
+		cache->data = malloc(cache->size);
+	}
+
+	cache->index.frames = max(cache->size / CACHE_FRAME_MIN, 64);
+	cache->index.starts = malloc(cache->index.frames * sizeof(size_t));
+
+	raop_cache_reset(cache);
+
+	return cache;
+}
+
+/*----------------------------------------------------------------------------*/
+void raop_cache_delete(struct raop_cache_s *cache)
+{
+	if (!cache) return;
+
+	if (cache->pool) {
+		pthread_mutex_lock(&cache->pool->mutex);
+		cache->pool->used[cache->slot] = false;
+		pthread_mutex_unlock(&cache->pool->mutex);
+	} else {
+		free(cache->data);
+	}
+
+	free(cache->index.starts);
+	free(cache);
+}
+
+/*----------------------------------------------------------------------------*/
+void raop_cache_reset(struct raop_cache_s *cache)
+{
+	cache->count = 0;
+	cache->index.next = cache->index.oldest = 0;
+}
+
+/*----------------------------------------------------------------------------*/
+void raop_cache_write(struct raop_cache_s *cache, uint8_t *frame, size_t len)
+{
+	size_t pos = cache->count % cache->size, space, base;
+
+	// a frame larger than cache could not be re-sent anyway
+	if (!len || len > cache->size) {
+		if (len) LOG_WARN("[%p]: frame of %zu bytes does not fit in cache", cache, len);
+		return;
+	}
+
+	space = min(len, cache->size - pos);
+	memcpy(cache->data + pos, frame, space);
+	memcpy(cache->data, frame + space, len - space);
+
+	cache->index.starts[cache->index.next++ % cache->index.frames] = cache->count;
+	cache->count += len;
+
+	// frames that are not indexed anymore or that have been partially overwritten
+	base = cache->count > cache->size ? cache->count - cache->size : 0;
+	while (cache->index.next - cache->index.oldest > cache->index.frames ||
+		   cache->index.starts[cache->index.oldest % cache->index.frames] < base) {
+		cache->index.oldest++;
+	}
+}
+
+/*----------------------------------------------------------------------------*/
+size_t raop_cache_count(struct raop_cache_s *cache)
+{
+	return cache->count;
+}
+
+/*----------------------------------------------------------------------------*/
+size_t raop_cache_size(struct raop_cache_s *cache)
+{
+	return cache->size;
+}
+
+/*----------------------------------------------------------------------------*/
+size_t raop_cache_start(struct raop_cache_s *cache)
+{
+	return cache->index.oldest != cache->index.next ? cache->index.starts[cache->index.oldest % cache->index.frames] : cache->count;
+}
+
+/*----------------------------------------------------------------------------*/
+int raop_cache_read(struct raop_cache_s *cache, size_t offset, size_t len, struct iovec iov[2])
+{
+	size_t pos = offset % cache->size;
+	int n = 0;
+
+	if (!len) return 0;
+
+	// ring might wrap
+	iov[n++] = (struct iovec) { cache->data + pos, min(len, cache->size - pos) };
+	if (len > iov[0].iov_len) iov[n++] = (struct iovec) { cache->data, len - iov[0].iov_len };
+
+	return n;
+}
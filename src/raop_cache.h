@@ -0,0 +1,54 @@
+/*
+ * RAOP: HTTP replay cache
+ *
+ * (c) Philippe, philippe_44@outlook.com
+ *
+ * See LICENSE
+ *
+ */
+
+#pragma once
+
+#include "platform.h"
+
+#if WIN
+struct iovec {
+	void *iov_base;
+	size_t iov_len;
+};
+#else
+#include <sys/uio.h>
+#endif
+
+/*
+ The encoded HTTP stream is kept in a ring so that clients can (re)start from
+ any position still in it, addressed by its offset since the beginning of the
+ stream. Each write is one encoded frame and frames are indexed so that the
+ window always starts on a frame.
+
+ Rings are taken from a pool that can be shared by many sessions, either in
+ memory or in a file mapped in memory (put it on a tmpfs like /dev/shm so that
+ it's never written to disk, not available on Windows). When there is no pool
+ or when it's exhausted, a session allocates its own ring of RAOP_CACHE_SIZE.
+ A pool must outlive the caches taken from it.
+*/
+
+#define RAOP_CACHE_SIZE (2048*1024)
+
+typedef enum { RAOP_CACHE_MEMORY, RAOP_CACHE_FILE } raop_cache_backend_t;
+
+struct raop_cache_pool_s;
+struct raop_cache_s;
+
+// dir is only used by file backend, NULL is /dev/shm
+struct raop_cache_pool_s*	raop_cache_pool_create(raop_cache_backend_t backend, char *dir, size_t size, int count);
+void 						raop_cache_pool_destroy(struct raop_cache_pool_s *pool);
+
+struct raop_cache_s*		raop_cache_create(struct raop_cache_pool_s *pool);
+void 						raop_cache_delete(struct raop_cache_s *cache);
+void 						raop_cache_reset(struct raop_cache_s *cache);
+void 						raop_cache_write(struct raop_cache_s *cache, uint8_t *frame, size_t len);
+size_t 						raop_cache_count(struct raop_cache_s *cache);
+size_t 						raop_cache_size(struct raop_cache_s *cache);
+size_t 						raop_cache_start(struct raop_cache_s *cache);
+int 						raop_cache_read(struct raop_cache_s *cache, size_t offset, size_t len, struct iovec iov[2]);
@@ -18,7 +18,9 @@
 #include <semaphore.h>
 #include <time.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <limits.h>
+#include <stdatomic.h>
 
 #include "alac_wrapper.h"
 #include "cross_net.h"
@@ -27,9 +29,15 @@
 
 #include "rtsp_client.h"
 #include "raop_client.h"
-#include "aes.h"
+#include "raop_hist_atomic.h"
+#include "raop_reactor.h"
+#include "pcm_pack.h"
+#include "aes_cbc.h"
 
 #define MAX_BACKLOG 512
+#define MAX_PAYLOAD_OVERHEAD 64	// ALAC headers/escape on top of raw PCM size
+#define MAX_BATCH 64				// packets per sendmmsg call
+#define MAX_GROUP_MEMBERS 32
 
 #define JACK_STATUS_DISCONNECTED 0
 #define JACK_STATUS_CONNECTED 1
@@ -137,20 +145,36 @@ typedef struct raopcl_s {
 		struct { unsigned int avail, select, send; } audio;
 	} sane;
 	unsigned int retransmit;
+	atomic_ullong metrics[sizeof(raopcl_metrics_t) / sizeof(uint64_t)];
+	uint64_t last_sync;
 	uint8_t iv[16]; // initialization vector for aes-cbc
 	uint8_t key[16]; // key for aes-cbc
 	struct in_addr	peer_addr, host_addr;
 	uint16_t rtsp_port;
 	rtp_port_t	rtp_ports;
 	struct {
+		atomic_uint lock;	// seqlock, odd when slot is being written
 		uint16_t seq_number;
 		uint64_t timestamp;
 		int	size;
 		uint8_t *buffer;
 	} backlog[MAX_BACKLOG];
+	uint8_t *arena;			// backing store for all backlog buffers
+	uint8_t *scratch;		// copies of backlog slots for re-transmit
+	int slot_size;
+	struct {
+		uint8_t *buffer, *chunk;
+		uint32_t size;				// in frames, power of 2
+		atomic_uint head, tail;		// head is producer's, tail is pacer's
+		bool running;
+		pthread_t thread;
+		pthread_mutex_t mutex;
+		pthread_cond_t cond;
+		atomic_bool waiting;		// pacer is waiting for frames
+	} push;
 	// int ajstatus, ajtype;
 	float volume;
-	aes_context ctx;
+	aes_cbc_context cbc;
 	int size_in_aex;
 	bool encrypt;
 	bool first_pkt;
@@ -164,6 +188,15 @@ typedef struct raopcl_s {
 	pthread_t time_thread, ctrl_thread;
 	pthread_mutex_t mutex;
 	bool time_running, ctrl_running;
+	uint16_t ntp_rport;			// learnt from first timing request
+	struct raop_reactor_s *reactor;
+	int tick_fd;
+	struct {
+		pthread_t thread;
+		bool started;
+		atomic_bool busy;
+	} keepalive;				// RTSP round trip off the reactor
+	struct raopcl_group_s *group;
 	int sample_rate, sample_size, channels;
 	raop_codec_t codec;
 	struct alac_codec_s *alac_codec;
@@ -177,14 +210,63 @@ typedef struct raopcl_s {
 } raopcl_data_t;
 
 
+typedef struct raopcl_group_s {
+	pthread_mutex_t mutex;
+	raop_codec_t codec;
+	int chunk_len, sample_rate;
+	struct alac_codec_s *alac_codec;
+	uint8_t *buffer;	// encoded payload shared by all members
+	int size;
+	int count;
+	struct {
+		struct raopcl_s *p;
+		bool ready;
+	} members[MAX_GROUP_MEMBERS];
+} raopcl_group_t;
+
 extern log_level	raop_loglevel;
 static log_level 	*loglevel = &raop_loglevel;
 
+#define METRIC(field) (offsetof(raopcl_metrics_t, field) / sizeof(uint64_t))
+#define METRIC_ADD(p, field, value) atomic_fetch_add_explicit(&(p)->metrics[METRIC(field)], (value), memory_order_relaxed)
+
+static const struct {
+	char *name;
+	size_t index;
+	char *help;
+} _metrics_counters[] = {
+	{ "packets", METRIC(packets), "audio packets sent" },
+	{ "bytes", METRIC(bytes), "audio bytes sent" },
+	{ "retransmit_nack", METRIC(retransmit.nack), "packets re-sent on player request" },
+	{ "retransmit_resume", METRIC(retransmit.resume), "packets re-sent at resume" },
+	{ "nack_requests", METRIC(nack.requests), "re-send requests received" },
+	{ "nack_packets", METRIC(nack.packets), "packets requested to be re-sent" },
+	{ "out_of_backlog", METRIC(out_of_backlog), "requested packets no more in backlog" },
+	{ "missed", METRIC(missed), "requested packets being overwritten" },
+	{ "errors_select", METRIC(errors.select), "audio socket select failures" },
+	{ "errors_avail", METRIC(errors.avail), "audio socket not writable" },
+	{ "errors_send", METRIC(errors.send), "audio send failures" },
+}, _metrics_histograms[] = {
+	{ "encode", METRIC(encode), "chunk encoding time" },
+	{ "lock", METRIC(lock), "time mutex is held per chunk" },
+	{ "sync_interval", METRIC(sync), "interval between sync packets" },
+};
+
 static void 	*_rtp_timing_thread(void *args);
 static void 	*_rtp_control_thread(void *args);
+static int 		_raopcl_handle_time(struct raopcl_s *p);
+static void 	_raopcl_handle_ctrl(struct raopcl_s *p);
+static void 	_raopcl_tick(struct raopcl_s *p);
+static void 	*_raopcl_keepalive_thread(void *args);
+static void 	_raopcl_reactor_cb(void *owner, int fd);
+static void 	*_raopcl_pacer_thread(void *args);
+static inline void _backlog_write_begin(struct raopcl_s *p, uint16_t n);
+static inline void _backlog_write_end(struct raopcl_s *p, uint16_t n);
 static void 	_raopcl_terminate_rtp(struct raopcl_s *p);
 static void 	_raopcl_send_sync(struct raopcl_s *p, bool first);
 static bool 	_raopcl_send_audio(struct raopcl_s *p, rtp_audio_pkt_t *packet, int size);
+static int 		_raopcl_send_audio_batch(struct raopcl_s *p, uint8_t **packets, int *sizes, int count);
+static int 		_raopcl_send_batch(int fd, struct sockaddr_in *addr, uint8_t **packets, int *sizes, int count);
 static bool 	_raopcl_disconnect(struct raopcl_s *p, bool force);
 
 /*----------------------------------------------------------------------------*/
@@ -212,9 +294,8 @@ uint32_t raopcl_sample_rate(struct raopcl_s *p)
 }
 
 /*----------------------------------------------------------------------------*/
-uint64_t raopcl_get_ntp(struct ntp_s* ntp)
+static uint64_t _raopcl_us_to_ntp(uint64_t time, struct ntp_s* ntp)
 {
-	uint64_t time = gettime_us();
 	uint32_t seconds = time / (1000 * 1000);
 	seconds += NTP_EPOCH_DELTA; // Convert to NTP epoch (1900-01-01)
 	uint32_t fraction = ((time % (1000 * 1000)) << 32) / (1000 * 1000);
@@ -227,6 +308,12 @@ uint64_t raopcl_get_ntp(struct ntp_s* ntp)
 	return ((uint64_t) seconds << 32) | fraction;
 }
 
+/*----------------------------------------------------------------------------*/
+uint64_t raopcl_get_ntp(struct ntp_s* ntp)
+{
+	return _raopcl_us_to_ntp(gettime_us(), ntp);
+}
+
 /*----------------------------------------------------------------------------*/
 uint64_t raopcl_time32_to_ntp(uint32_t time)
 {
@@ -272,6 +359,108 @@ bool raopcl_is_sane(struct raopcl_s *p)
 	return true;
 }
 
+/*----------------------------------------------------------------------------*/
+bool raopcl_metrics(struct raopcl_s *p, raopcl_metrics_t *metrics)
+{
+	uint64_t *values = (uint64_t*) metrics;
+
+	if (!p || !metrics) return false;
+
+	// each value is consistent, not the set, which is good enough for counters
+	for (size_t i = 0; i < sizeof(p->metrics) / sizeof(*p->metrics); i++) {
+		values[i] = atomic_load_explicit(p->metrics + i, memory_order_relaxed);
+	}
+
+	return true;
+}
+
+/*----------------------------------------------------------------------------*/
+static char *_metrics_label(char **names, int n, char *label, size_t size)
+{
+	if (names && names[n]) snprintf(label, size, "player=\"%s\"", names[n]);
+	else *label = '\0';
+	return label;
+}
+
+/*----------------------------------------------------------------------------*/
+int raopcl_metrics_print(raopcl_metrics_t *metrics, char **names, int count, raopcl_metrics_format_t format, char *buf, size_t size)
+{
+	size_t len = 0;
+	char label[128];
+
+// keep counting when buffer is full, like snprintf does
+#define PRINT(...) len += snprintf(buf + min(len, size), size - min(len, size), __VA_ARGS__)
+#define VALUES(n) ((uint64_t*) (metrics + (n)))
+
+	if (!metrics || count <= 0) return -1;
+	if (!size) buf = NULL;
+
+	if (format == RAOPCL_METRICS_JSON) {
+		PRINT("[");
+
+		for (int n = 0; n < count; n++) {
+			PRINT("%s{", n ? "," : "");
+			if (names && names[n]) PRINT("\"player\":\"%s\",", names[n]);
+
+			for (size_t i = 0; i < sizeof(_metrics_counters) / sizeof(*_metrics_counters); i++) {
+				PRINT("\"%s\":%" PRIu64 ",", _metrics_counters[i].name, VALUES(n)[_metrics_counters[i].index]);
+			}
+
+			for (size_t i = 0; i < sizeof(_metrics_histograms) / sizeof(*_metrics_histograms); i++) {
+				raop_hist_t *hist = (raop_hist_t*) (VALUES(n) + _metrics_histograms[i].index);
+
+				PRINT("%s\"%s\":{\"count\":%" PRIu64 ",\"sum_us\":%" PRIu64 ",\"buckets\":[", i ? "," : "",
+					  _metrics_histograms[i].name, hist->count, hist->sum);
+				for (int j = 0; j < RAOP_HIST_BUCKETS; j++) PRINT("%s%" PRIu64, j ? "," : "", hist->buckets[j]);
+				PRINT("]}");
+			}
+
+			PRINT("}");
+		}
+
+		PRINT("]");
+		return len;
+	}
+
+	// a metric is one group with its header, then the samples of all players
+	for (size_t i = 0; i < sizeof(_metrics_counters) / sizeof(*_metrics_counters); i++) {
+		PRINT("# HELP raop_%s_total %s\n# TYPE raop_%s_total counter\n", _metrics_counters[i].name,
+			  _metrics_counters[i].help, _metrics_counters[i].name);
+		for (int n = 0; n < count; n++) {
+			PRINT("raop_%s_total{%s} %" PRIu64 "\n", _metrics_counters[i].name, _metrics_label(names, n, label, sizeof(label)),
+				  VALUES(n)[_metrics_counters[i].index]);
+		}
+	}
+
+	for (size_t i = 0; i < sizeof(_metrics_histograms) / sizeof(*_metrics_histograms); i++) {
+		PRINT("# HELP raop_%s_seconds %s\n# TYPE raop_%s_seconds histogram\n", _metrics_histograms[i].name,
+			  _metrics_histograms[i].help, _metrics_histograms[i].name);
+
+		for (int n = 0; n < count; n++) {
+			raop_hist_t *hist = (raop_hist_t*) (VALUES(n) + _metrics_histograms[i].index);
+			uint64_t total = 0;
+
+			_metrics_label(names, n, label, sizeof(label));
+
+			// Prometheus buckets are cumulative
+			for (int j = 0; j < RAOP_HIST_BUCKETS; j++) {
+				total += hist->buckets[j];
+				if (j < RAOP_HIST_BUCKETS - 1) PRINT("raop_%s_seconds_bucket{%s%sle=\"%g\"} %" PRIu64 "\n", _metrics_histograms[i].name,
+													   label, *label ? "," : "", (double) (2ULL << j) / 1000000, total);
+				else PRINT("raop_%s_seconds_bucket{%s%sle=\"+Inf\"} %" PRIu64 "\n", _metrics_histograms[i].name, label, *label ? "," : "", total);
+			}
+
+			PRINT("raop_%s_seconds_sum{%s} %g\n", _metrics_histograms[i].name, label, (double) hist->sum / 1000000);
+			PRINT("raop_%s_seconds_count{%s} %" PRIu64 "\n", _metrics_histograms[i].name, label, hist->count);
+		}
+	}
+
+#undef VALUES
+#undef PRINT
+
+	return len;
+}
+
 /*----------------------------------------------------------------------------*/
 bool raopcl_is_playing(struct raopcl_s *p)
 {
@@ -312,36 +501,6 @@ static int rsa_encrypt(uint8_t *text, int len, uint8_t *res)
 	return size;
 }
 
-/*----------------------------------------------------------------------------*/
-static int raopcl_encrypt(raopcl_data_t *raopcld, uint8_t *data, int size)
-{
-	uint8_t *buf;
-	uint8_t nv[16];
-	int i=0,j;
-	memcpy(nv,raopcld->iv,16);
-	while(i+16<=size){
-		buf=data+i;
-		for(j=0;j<16;j++) buf[j] ^= nv[j];
-		aes_encrypt(&raopcld->ctx, buf, buf);
-		memcpy(nv,buf,16);
-		i+=16;
-	}
-#if 0
-	if(i<size){
-		uint8_t tmp[16];
-		LOG_INFO("[%p]: a block less than 16 bytes(%d) is not encrypted", raopcld, size-i);
-		memset(tmp,0,16);
-		memcpy(tmp,data+i,size-i);
-		for(j=0;j<16;j++) tmp[j] ^= nv[j];
-		aes_encrypt(&raopcld->ctx, tmp, tmp);
-		memcpy(nv,tmp,16);
-		memcpy(data+i,tmp,16);
-		i+=16;
-	}
-#endif
-	return i;
-}
-
 /*----------------------------------------------------------------------------*/
 bool raopcl_keepalive(struct raopcl_s *p) {
 	return rtspcl_options(p->rtspcl, NULL);
@@ -428,6 +587,8 @@ bool raopcl_accept_frames(struct raopcl_s *p)
 		}
 		else {
 			uint16_t n, i, chunks = raopcl_latency(p) / p->chunk_len;
+			uint8_t *packets[MAX_BACKLOG];
+			int count, sizes[MAX_BACKLOG];
 
 			// if un-pausing w/o start_time, can anticipate as we have buffer
 			p->first_ts = p->start_ts ? p->start_ts : now_ts - raopcl_latency(p);
@@ -437,24 +598,35 @@ bool raopcl_accept_frames(struct raopcl_s *p)
 
 			if (first_pkt) _raopcl_send_sync(p, true);
 
-			LOG_INFO("[%p]: restarting w/ pause n:%u.%u, hts:%" PRIu64 " (re-send: %d)", p, RAOP_SECNTP(now), p->head_ts, chunks);
-
 			// search pause_ts in backlog, it should be backward, not too far
 			for (n = p->seq_number, i = 0;
 				 i < MAX_BACKLOG && p->backlog[n % MAX_BACKLOG].timestamp > p->pause_ts;
 				 i++, n--) { };
 
+			/*
+			 Re-sent packets are moved to the slots of their new seq_number. These must
+			 not be ones still to be re-sent or already in the batch, so both windows
+			 must fit in the backlog, with the i packets sent after pause_ts between them
+			*/
+			chunks = min(chunks, (MAX_BACKLOG - i) / 2);
+
+			LOG_INFO("[%p]: restarting w/ pause n:%u.%u, hts:%" PRIu64 " (re-send: %d)", p, RAOP_SECNTP(now), p->head_ts, chunks);
+
 			 // the resend shall go up to (including) pause_ts
 			 n = (n - chunks + 1) % MAX_BACKLOG;
 
-			// re-send old packets
-			for (i = 0; i < chunks; i++) {
+			// re-send old packets, all in one go
+			for (count = 0, i = 0; i < chunks; i++) {
 				rtp_audio_pkt_t *packet;
 				uint16_t reindex, index = (n + i) % MAX_BACKLOG;
 
-				if (!p->backlog[index].buffer) continue;
+				if (!p->backlog[index].size) continue;
 
 				p->seq_number++;
+				reindex = p->seq_number % MAX_BACKLOG;
+
+				_backlog_write_begin(p, index);
+				if (reindex != index) _backlog_write_begin(p, reindex);
 
 				packet = (rtp_audio_pkt_t*) (p->backlog[index].buffer + sizeof(rtp_header_t));
 				packet->hdr.seq[0] = (p->seq_number >> 8) & 0xff;
@@ -463,22 +635,31 @@ bool raopcl_accept_frames(struct raopcl_s *p)
 				packet->hdr.type = 0x60 | (p->first_pkt ? 0x80 : 0);
 				p->first_pkt = false;
 
-				// then replace packets in backlog in case
-				reindex = p->seq_number % MAX_BACKLOG;
+				// then replace packets in backlog in case (swap buffers, they belong to the arena)
+				if (reindex != index) {
+					uint8_t *buffer = p->backlog[reindex].buffer;
+					p->backlog[reindex].buffer = p->backlog[index].buffer;
+					p->backlog[reindex].size = p->backlog[index].size;
+					p->backlog[index].buffer = buffer;
+					p->backlog[index].size = 0;
+				}
 
 				p->backlog[reindex].seq_number = p->seq_number;
 				p->backlog[reindex].timestamp = p->head_ts;
-				if (p->backlog[reindex].buffer) free(p->backlog[reindex].buffer);
-				p->backlog[reindex].buffer = p->backlog[index].buffer;
-				p->backlog[reindex].size = p->backlog[index].size;
-				p->backlog[index].buffer = NULL;
+
+				if (reindex != index) _backlog_write_end(p, reindex);
+				_backlog_write_end(p, index);
 
 				p->head_ts += p->chunk_len;
 
-				_raopcl_send_audio(p, packet, p->backlog[reindex].size);
+				packets[count] = (uint8_t*) packet;
+				sizes[count++] = p->backlog[reindex].size;
 			}
 
-			LOG_DEBUG("[%p]: finished resend %u", p, i);
+			count = _raopcl_send_audio_batch(p, packets, sizes, count);
+			METRIC_ADD(p, retransmit.resume, count);
+
+			LOG_DEBUG("[%p]: finished resend %u (sent:%d)", p, i, count);
 		}
 
 		p->pause_ts = p->start_ts = 0;
@@ -497,20 +678,102 @@ bool raopcl_accept_frames(struct raopcl_s *p)
 }
 
 /*----------------------------------------------------------------------------*/
-bool raopcl_send_chunk(struct raopcl_s *p, uint8_t *sample, int frames, uint64_t *playtime)
+static int _raopcl_pcm_to_alac_raw(uint8_t *out, uint8_t *sample, int frames, int bsize)
+{
+	uint8_t *p = out;
+	int count;
+
+	frames = min(frames, bsize);
+
+	// stereo, has size, not compressed then block size on 32 bits
+	*p++ = 1 << 5;
+	*p++ = 0;
+	*p++ = (1 << 4) | (1 << 1) | ((bsize >> 31) & 0x01);
+	*p++ = bsize >> 23;
+	*p++ = bsize >> 15;
+	*p++ = bsize >> 7;
+	*p = bsize << 1;
+
+	// then 16 bits samples in big endian, everything is off by one bit
+	count = frames * 2;
+	if (count) {
+		*p |= sample[1] >> 7;
+		pcm_alac_words(p + 1, sample, count);
+		p += count * 2;
+	}
+
+	// pad with silence up to block size
+	count = (bsize - frames) * 4;
+	memset(p + 1, 0, count);
+	p += count;
+
+	// end tag (3 bits)
+	*p++ |= 0x01;
+	*p++ = 0xc0;
+
+	return p - out;
+}
+
+/*----------------------------------------------------------------------------*/
+static int _raopcl_encode_chunk(raop_codec_t codec, struct alac_codec_s *alac_codec, int chunk_len,
+								uint8_t *sample, int frames, uint8_t *out, int max_size)
 {
-	uint8_t *encoded, *buffer;
-	rtp_audio_pkt_t *packet;
-	size_t n;
 	int size;
-	uint64_t now = raopcl_get_ntp(NULL);
 
-	if (!p || !sample) {
-		LOG_ERROR("[%p]: something went wrong (s:%p)", p, sample);
-		return false;
+	frames = min(frames, chunk_len);
+
+	switch (codec) {
+		case RAOP_ALAC: {
+			uint8_t *encoded;
+			// ALAC encoder has its own output buffer
+			pcm_to_alac(alac_codec, sample, frames, &encoded, &size);
+			if (size > max_size) {
+				if (encoded) free(encoded);
+				LOG_ERROR("encoded chunk too large %d (max:%d)", size, max_size);
+				return -1;
+			}
+			memcpy(out, encoded, size);
+			if (encoded) free(encoded);
+			break;
+		}
+		case RAOP_ALAC_RAW:
+			size = _raopcl_pcm_to_alac_raw(out, sample, frames, chunk_len);
+			break;
+		case RAOP_PCM:
+			pcm_swap16(out, sample, frames);
+			size = frames * 4;
+			break;
+		default:
+			LOG_ERROR("don't know what we're doing here (codec:%d)", codec);
+			return -1;
 	}
 
-	pthread_mutex_lock(&p->mutex);
+	return size;
+}
+
+/*
+ Backlog slots are always written with p->mutex held, but they are read without
+ it by re-transmit so that a NACK burst never stalls the audio. A reader copies
+ the slot and only uses the copy if the slot's seqlock has not moved meanwhile
+*/
+
+/*----------------------------------------------------------------------------*/
+static inline void _backlog_write_begin(struct raopcl_s *p, uint16_t n)
+{
+	atomic_fetch_add_explicit(&p->backlog[n].lock, 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+}
+
+/*----------------------------------------------------------------------------*/
+static inline void _backlog_write_end(struct raopcl_s *p, uint16_t n)
+{
+	atomic_fetch_add_explicit(&p->backlog[n].lock, 1, memory_order_release);
+}
+
+/*----------------------------------------------------------------------------*/
+static uint8_t *_raopcl_prepare_chunk(struct raopcl_s *p, int *max_size)
+{
+	uint16_t n;
 
 	/*
 	 Move to streaming state only when really flushed. In most cases, this is
@@ -519,39 +782,37 @@ bool raopcl_send_chunk(struct raopcl_s *p, uint8_t *sample, int frames, uint64_t
 	*/
 	if (p->state == RAOP_FLUSHED) {
 		p->first_pkt = true;
-		LOG_INFO("[%p]: begining to stream (LATE) hts:%" PRIu64 " n:%u.%u", p, p->head_ts, RAOP_SECNTP(now));
+		LOG_INFO("[%p]: begining to stream (LATE) hts:%" PRIu64 " n:%u.%u", p, p->head_ts, RAOP_SECNTP(raopcl_get_ntp(NULL)));
 		p->state = RAOP_STREAMING;
 		_raopcl_send_sync(p, true);
 	}
 
-	switch (p->codec) {
-		case RAOP_ALAC:
-			pcm_to_alac(p->alac_codec, sample, frames, &encoded, &size);
-			break;
-		case RAOP_ALAC_RAW:
-			pcm_to_alac_raw(sample, frames, &encoded, &size, p->chunk_len);
-			break;
-		case RAOP_PCM: {
-			uint8_t *src = sample, *dst = encoded = malloc(frames * 4);
-			for (size = 0; size < frames; size++) {
-				*dst++ = *(src + 1); *dst++ = *src++;
-				*dst++ = *(++src + 1); *dst++ = *src++;
-				src++;
-			}
-			size *= 4;
-			break;
-		}
-		default:
-			LOG_ERROR("[%p]: don't know what we're doing here", p);
-			return false;
-	}
+	/*
+	 Encode directly in the backlog slot that this packet will use. Slots are
+	 part of an arena allocated at creation so there is no allocation here, it
+	 is only overwritten (re-transmit header, then RTP header then payload)
+	*/
+	n = (uint16_t) (p->seq_number + 1) % MAX_BACKLOG;
+	*max_size = p->slot_size - sizeof(rtp_header_t) - sizeof(rtp_audio_pkt_t);
 
-	if ((buffer = malloc(sizeof(rtp_header_t) + sizeof(rtp_audio_pkt_t) + size)) == NULL) {
-		pthread_mutex_unlock(&p->mutex);
-		if (encoded) free(encoded);
-		LOG_ERROR("[%p]: cannot allocate buffer",p);
-		return false;
-	}
+	// slot is invalid until _raopcl_finish_chunk or _raopcl_abort_chunk
+	_backlog_write_begin(p, n);
+	p->backlog[n].size = 0;
+
+	return p->backlog[n].buffer + sizeof(rtp_header_t) + sizeof(rtp_audio_pkt_t);
+}
+
+/*----------------------------------------------------------------------------*/
+static void _raopcl_abort_chunk(struct raopcl_s *p)
+{
+	_backlog_write_end(p, (uint16_t) (p->seq_number + 1) % MAX_BACKLOG);
+}
+
+/*----------------------------------------------------------------------------*/
+static void _raopcl_finish_chunk(struct raopcl_s *p, int size, uint64_t *playtime)
+{
+	uint16_t n = (uint16_t) (p->seq_number + 1) % MAX_BACKLOG;
+	rtp_audio_pkt_t *packet = (rtp_audio_pkt_t *) (p->backlog[n].buffer + sizeof(rtp_header_t));
 
 	*playtime = TS2NTP(p->head_ts + raopcl_latency(p), p->sample_rate);
 
@@ -560,7 +821,6 @@ bool raopcl_send_chunk(struct raopcl_s *p, uint8_t *sample, int frames, uint64_t
 	p->seq_number++;
 
 	// packet is after re-transmit header
-	packet = (rtp_audio_pkt_t *) (buffer + sizeof(rtp_header_t));
 	packet->hdr.proto = 0x80;
 	packet->hdr.type = 0x60 | (p->first_pkt ? 0x80 : 0);
 	p->first_pkt = false;
@@ -569,24 +829,54 @@ bool raopcl_send_chunk(struct raopcl_s *p, uint8_t *sample, int frames, uint64_t
 	packet->timestamp = htonl(p->head_ts);
 	packet->ssrc = htonl(p->ssrc);
 
-	memcpy((uint8_t*) packet + sizeof(rtp_audio_pkt_t), encoded, size);
-
 	// with newer airport express, don't use encryption (??)
-	if (p->encrypt) raopcl_encrypt(p, (uint8_t*) packet + sizeof(rtp_audio_pkt_t), size);
+	if (p->encrypt) aes_cbc_encrypt(&p->cbc, (uint8_t*) packet + sizeof(rtp_audio_pkt_t), size);
 
-	n = p->seq_number % MAX_BACKLOG;
 	p->backlog[n].seq_number = p->seq_number;
 	p->backlog[n].timestamp = p->head_ts;
-	if (p->backlog[n].buffer) free(p->backlog[n].buffer);
-	p->backlog[n].buffer = buffer;
 	p->backlog[n].size = sizeof(rtp_audio_pkt_t) + size;
 
+	_backlog_write_end(p, n);
+
 	p->head_ts += p->chunk_len;
 
 	_raopcl_send_audio(p, packet, sizeof(rtp_audio_pkt_t) + size);
+}
+
+/*----------------------------------------------------------------------------*/
+bool raopcl_send_chunk(struct raopcl_s *p, uint8_t *sample, int frames, uint64_t *playtime)
+{
+	uint8_t *payload;
+	int size, max_size;
+	uint64_t now = raopcl_get_ntp(NULL), locked, encoded, unlocked;
+
+	if (!p || !sample) {
+		LOG_ERROR("[%p]: something went wrong (s:%p)", p, sample);
+		return false;
+	}
+
+	pthread_mutex_lock(&p->mutex);
+	locked = gettime_us();
+
+	payload = _raopcl_prepare_chunk(p, &max_size);
+	size = _raopcl_encode_chunk(p->codec, p->alac_codec, p->chunk_len, sample, frames, payload, max_size);
+	encoded = gettime_us();
+
+	if (size < 0) {
+		_raopcl_abort_chunk(p);
+		pthread_mutex_unlock(&p->mutex);
+		LOG_ERROR("[%p]: cannot encode chunk", p);
+		return false;
+	}
+
+	_raopcl_finish_chunk(p, size, playtime);
 
+	unlocked = gettime_us();
 	pthread_mutex_unlock(&p->mutex);
 
+	raop_hist_add(p->metrics + METRIC(encode), encoded - locked);
+	raop_hist_add(p->metrics + METRIC(lock), unlocked - locked);
+
 	if (NTP2MS(*playtime) % 60000 < 8) {
 		LOG_INFO("[%p]: check n:%u p:%u ts:%" PRIu64 " sn:%u\n               "
 				  "retr: %u, avail: %u, send: %u, select: %u)", p,
@@ -595,19 +885,418 @@ bool raopcl_send_chunk(struct raopcl_s *p, uint8_t *sample, int frames, uint64_t
 				 p->sane.audio.select);
 	}
 
-	if (encoded) free(encoded);
+	return true;
+}
+
+/*----------------------------------------------------------------------------*/
+struct raopcl_group_s *raopcl_group_create(raop_codec_t codec, int chunk_len,
+										   int sample_rate, int sample_size, int channels)
+{
+	struct raopcl_group_s *g;
+
+	if (chunk_len > MAX_FRAMES_PER_CHUNK) {
+		LOG_ERROR("Chunk length must below %d", MAX_FRAMES_PER_CHUNK);
+		return NULL;
+	}
+
+	g = malloc(sizeof(struct raopcl_group_s));
+	memset(g, 0, sizeof(struct raopcl_group_s));
+
+	g->codec = codec;
+	g->chunk_len = chunk_len;
+	g->sample_rate = sample_rate;
+
+	// same fallback as a single player so that members can match
+	if (codec == RAOP_ALAC && (g->alac_codec = alac_create_encoder(chunk_len, sample_rate, sample_size, channels)) == NULL) {
+		LOG_WARN("[%p]: cannot create ALAC codec", g);
+		g->codec = RAOP_ALAC_RAW;
+	}
+
+	g->size = chunk_len * 4 + MAX_PAYLOAD_OVERHEAD;
+
+	if ((g->buffer = malloc(g->size)) == NULL) {
+		LOG_ERROR("[%p]: Cannot allocate group buffer", g);
+		if (g->alac_codec) alac_delete_encoder(g->alac_codec);
+		free(g);
+		return NULL;
+	}
+
+	pthread_mutex_init(&g->mutex, NULL);
+
+	return g;
+}
+
+/*----------------------------------------------------------------------------*/
+void raopcl_group_destroy(struct raopcl_group_s *g)
+{
+	if (!g) return;
+
+	for (int i = 0; i < g->count; i++) g->members[i].p->group = NULL;
+
+	pthread_mutex_destroy(&g->mutex);
+	if (g->alac_codec) alac_delete_encoder(g->alac_codec);
+	free(g->buffer);
+	free(g);
+}
+
+/*----------------------------------------------------------------------------*/
+bool raopcl_group_add(struct raopcl_group_s *g, struct raopcl_s *p)
+{
+	if (!g || !p) return false;
+
+	// payload is shared as-is, so it must be the exact same format
+	if (p->codec != g->codec || p->chunk_len != g->chunk_len || p->sample_rate != g->sample_rate) {
+		LOG_ERROR("[%p]: player %p does not match group (codec:%d/%d len:%d/%d)", g, p,
+				  p->codec, g->codec, p->chunk_len, g->chunk_len);
+		return false;
+	}
+
+	pthread_mutex_lock(&g->mutex);
+
+	if (g->count == MAX_GROUP_MEMBERS) {
+		pthread_mutex_unlock(&g->mutex);
+		LOG_ERROR("[%p]: group is full (%d)", g, MAX_GROUP_MEMBERS);
+		return false;
+	}
+
+	// player's group is only known by the player to leave it when destroyed
+	if (p->group) {
+		pthread_mutex_unlock(&g->mutex);
+		if (p->group != g) LOG_ERROR("[%p]: player %p already in group %p", g, p, p->group);
+		return p->group == g;
+	}
+
+	p->group = g;
+	g->members[g->count].p = p;
+	g->members[g->count++].ready = false;
+
+	pthread_mutex_unlock(&g->mutex);
+
+	LOG_INFO("[%p]: player %p joined group (%d)", g, p, g->count);
 
 	return true;
 }
 
 /*----------------------------------------------------------------------------*/
-bool _raopcl_send_audio(struct raopcl_s *p, rtp_audio_pkt_t *packet, int size)
+bool raopcl_group_remove(struct raopcl_group_s *g, struct raopcl_s *p)
+{
+	bool found = false;
+
+	if (!g || !p) return false;
+
+	pthread_mutex_lock(&g->mutex);
+
+	for (int i = 0; i < g->count; i++) if (g->members[i].p == p) {
+		g->members[i] = g->members[--g->count];
+		p->group = NULL;
+		found = true;
+		break;
+	}
+
+	pthread_mutex_unlock(&g->mutex);
+
+	if (found) LOG_INFO("[%p]: player %p left group (%d)", g, p, g->count);
+
+	return found;
+}
+
+/*----------------------------------------------------------------------------*/
+bool raopcl_group_accept_frames(struct raopcl_group_s *g)
+{
+	bool accept = true;
+	int connected = 0;
+
+	if (!g) return false;
+
+	pthread_mutex_lock(&g->mutex);
+
+	/*
+	 Every member runs its own state machine and pace, but a chunk can only be
+	 sent when all connected ones can take it, otherwise the ones that are not
+	 ready would miss it and fall out of alignment
+	*/
+	for (int i = 0; i < g->count; i++) {
+		struct raopcl_s *p = g->members[i].p;
+
+		g->members[i].ready = false;
+		if (raopcl_state(p) == RAOP_DOWN) continue;
+
+		connected++;
+		g->members[i].ready = raopcl_accept_frames(p);
+		accept &= g->members[i].ready;
+	}
+
+	pthread_mutex_unlock(&g->mutex);
+
+	return accept && connected;
+}
+
+/*----------------------------------------------------------------------------*/
+int raopcl_group_send_chunk(struct raopcl_group_s *g, uint8_t *sample, int frames, uint64_t *playtime)
+{
+	int size, count = 0;
+	uint64_t encoded;
+
+	if (!g || !sample) {
+		LOG_ERROR("[%p]: something went wrong (s:%p)", g, sample);
+		return 0;
+	}
+
+	pthread_mutex_lock(&g->mutex);
+
+	// encode once for everybody
+	encoded = gettime_us();
+	size = _raopcl_encode_chunk(g->codec, g->alac_codec, g->chunk_len, sample, frames, g->buffer, g->size);
+	encoded = gettime_us() - encoded;
+
+	if (size < 0) {
+		pthread_mutex_unlock(&g->mutex);
+		LOG_ERROR("[%p]: cannot encode chunk", g);
+		return 0;
+	}
+
+	// then each member only does copy, RTP header, encryption and send
+	for (int i = 0; i < g->count; i++) {
+		struct raopcl_s *p = g->members[i].p;
+		uint64_t member_playtime, locked;
+		uint8_t *payload;
+		int max_size;
+
+		if (!g->members[i].ready) continue;
+		g->members[i].ready = false;
+
+		pthread_mutex_lock(&p->mutex);
+		locked = gettime_us();
+
+		payload = _raopcl_prepare_chunk(p, &max_size);
+
+		if (size <= max_size) {
+			memcpy(payload, g->buffer, size);
+			_raopcl_finish_chunk(p, size, &member_playtime);
+			if (playtime && !count++) *playtime = member_playtime;
+		} else _raopcl_abort_chunk(p);
+
+		locked = gettime_us() - locked;
+		pthread_mutex_unlock(&p->mutex);
+
+		// encoding is shared, but each member depends on it
+		raop_hist_add(p->metrics + METRIC(encode), encoded);
+		raop_hist_add(p->metrics + METRIC(lock), locked);
+	}
+
+	pthread_mutex_unlock(&g->mutex);
+
+	return count;
+}
+
+/*----------------------------------------------------------------------------*/
+bool raopcl_start_push(struct raopcl_s *p, uint32_t frames)
+{
+	uint32_t size;
+
+	if (!p || p->push.running) return false;
+
+	// ring size is a power of 2 so that counters can just wrap
+	for (size = 1; size < max(frames, (uint32_t) p->chunk_len * 2); size <<= 1);
+
+	p->push.buffer = malloc(size * 4);
+	p->push.chunk = malloc(p->chunk_len * 4);
+
+	if (!p->push.buffer || !p->push.chunk) {
+		LOG_ERROR("[%p]: cannot allocate push buffer %u", p, size);
+		free(p->push.buffer);
+		free(p->push.chunk);
+		p->push.buffer = p->push.chunk = NULL;
+		return false;
+	}
+
+	p->push.size = size;
+	atomic_store(&p->push.head, 0);
+	atomic_store(&p->push.tail, 0);
+	atomic_store(&p->push.waiting, false);
+	pthread_mutex_init(&p->push.mutex, NULL);
+	pthread_cond_init(&p->push.cond, NULL);
+	p->push.running = true;
+
+	pthread_create(&p->push.thread, NULL, _raopcl_pacer_thread, (void*) p);
+
+	LOG_INFO("[%p]: push mode started with %u frames", p, size);
+
+	return true;
+}
+
+/*----------------------------------------------------------------------------*/
+void raopcl_stop_push(struct raopcl_s *p)
+{
+	if (!p || !p->push.running) return;
+
+	pthread_mutex_lock(&p->push.mutex);
+	p->push.running = false;
+	pthread_cond_signal(&p->push.cond);
+	pthread_mutex_unlock(&p->push.mutex);
+
+	pthread_join(p->push.thread, NULL);
+
+	pthread_cond_destroy(&p->push.cond);
+	pthread_mutex_destroy(&p->push.mutex);
+	free(p->push.buffer);
+	free(p->push.chunk);
+	p->push.buffer = p->push.chunk = NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+uint32_t raopcl_push_space(struct raopcl_s *p)
+{
+	if (!p || !p->push.running) return 0;
+
+	return p->push.size - (atomic_load_explicit(&p->push.head, memory_order_relaxed) -
+						   atomic_load_explicit(&p->push.tail, memory_order_acquire));
+}
+
+/*----------------------------------------------------------------------------*/
+uint32_t raopcl_push_frames(struct raopcl_s *p, uint8_t *sample, uint32_t frames)
+{
+	uint32_t head, space, offset, count;
+
+	if (!p || !p->push.running) return 0;
+
+	// single producer, so only the tail can move under our feet (and free space)
+	head = atomic_load_explicit(&p->push.head, memory_order_relaxed);
+	space = p->push.size - (head - atomic_load_explicit(&p->push.tail, memory_order_acquire));
+	frames = min(frames, space);
+
+	offset = head & (p->push.size - 1);
+	count = min(frames, p->push.size - offset);
+
+	memcpy(p->push.buffer + offset * 4, sample, count * 4);
+	memcpy(p->push.buffer, sample + count * 4, (frames - count) * 4);
+
+	// must be ordered with the load of waiting, pacer does the opposite
+	atomic_store(&p->push.head, head + frames);
+
+	// only bother pacer when it's waiting for frames, it holds mutex until it really waits
+	if (atomic_load(&p->push.waiting)) {
+		pthread_mutex_lock(&p->push.mutex);
+		pthread_cond_signal(&p->push.cond);
+		pthread_mutex_unlock(&p->push.mutex);
+	}
+
+	return frames;
+}
+
+/*----------------------------------------------------------------------------*/
+static uint32_t _raopcl_next_chunk_us(struct raopcl_s *p)
+{
+	uint32_t chunk = (p->chunk_len * 1000000LL) / p->sample_rate;
+	uint64_t now_ts, due;
+
+	pthread_mutex_lock(&p->mutex);
+
+	// flushing or paused, there is no schedule to follow
+	if (p->flushing) {
+		pthread_mutex_unlock(&p->mutex);
+		return chunk;
+	}
+
+	now_ts = NTP2TS(raopcl_get_ntp(NULL), p->sample_rate);
+	due = p->head_ts + p->chunk_len;
+
+	pthread_mutex_unlock(&p->mutex);
+
+	return due > now_ts ? min((due - now_ts) * 1000000LL / p->sample_rate, chunk) : chunk / 4;
+}
+
+/*----------------------------------------------------------------------------*/
+static void *_raopcl_pacer_thread(void *args)
+{
+	raopcl_data_t *p = (raopcl_data_t*) args;
+
+	while (p->push.running) {
+		uint32_t tail = atomic_load_explicit(&p->push.tail, memory_order_relaxed);
+		uint32_t avail = atomic_load_explicit(&p->push.head, memory_order_acquire) - tail;
+		uint32_t offset, count;
+		uint64_t playtime;
+
+		// not enough frames, sleep until producer pushes more
+		if (avail < (uint32_t) p->chunk_len) {
+			pthread_mutex_lock(&p->push.mutex);
+			atomic_store(&p->push.waiting, true);
+			if (p->push.running && atomic_load(&p->push.head) - tail < (uint32_t) p->chunk_len) {
+				pthread_cond_wait(&p->push.cond, &p->push.mutex);
+			}
+			atomic_store(&p->push.waiting, false);
+			pthread_mutex_unlock(&p->push.mutex);
+			continue;
+		}
+
+		// player is ahead, sleep until next chunk is due
+		if (!raopcl_accept_frames(p)) {
+			usleep(_raopcl_next_chunk_us(p));
+			continue;
+		}
+
+		// chunk might wrap around the ring
+		offset = tail & (p->push.size - 1);
+		count = min((uint32_t) p->chunk_len, p->push.size - offset);
+		memcpy(p->push.chunk, p->push.buffer + offset * 4, count * 4);
+		memcpy(p->push.chunk + count * 4, p->push.buffer, (p->chunk_len - count) * 4);
+
+		atomic_store_explicit(&p->push.tail, tail + p->chunk_len, memory_order_release);
+
+		raopcl_send_chunk(p, p->push.chunk, p->chunk_len, &playtime);
+	}
+
+	return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+static int _raopcl_send_batch(int fd, struct sockaddr_in *addr, uint8_t **packets, int *sizes, int count)
+{
+	int sent = 0;
+
+#if LINUX
+	struct mmsghdr msgs[MAX_BATCH];
+	struct iovec iov[MAX_BATCH];
+
+	while (sent < count) {
+		int i, n = min(count - sent, MAX_BATCH);
+
+		memset(msgs, 0, n * sizeof(struct mmsghdr));
+
+		for (i = 0; i < n; i++) {
+			iov[i].iov_base = packets[sent + i];
+			iov[i].iov_len = sizes[sent + i];
+			msgs[i].msg_hdr.msg_name = addr;
+			msgs[i].msg_hdr.msg_namelen = sizeof(*addr);
+			msgs[i].msg_hdr.msg_iov = iov + i;
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		n = sendmmsg(fd, msgs, n, 0);
+
+		// old kernel, use the one-by-one loop for what remains
+		if (n < 0 && errno == ENOSYS) break;
+		if (n <= 0) return sent;
+
+		sent += n;
+	}
+#endif
+
+	for (; sent < count; sent++) {
+		if (sendto(fd, (void*) packets[sent], sizes[sent], 0, (void*) addr, sizeof(*addr)) != sizes[sent]) break;
+	}
+
+	return sent;
+}
+
+/*----------------------------------------------------------------------------*/
+static int _raopcl_send_audio_batch(struct raopcl_s *p, uint8_t **packets, int *sizes, int count)
 {
 	struct timeval timeout;
 	fd_set wfds;
 	struct sockaddr_in addr;
-	size_t n;
-	bool ret = true;
+	uint64_t bytes = 0;
+	int sent = 0;
 
 	/*
 	 Do not send if audio port closed or we are not yet in streaming state. We
@@ -617,46 +1306,68 @@ bool _raopcl_send_audio(struct raopcl_s *p, rtp_audio_pkt_t *packet, int size)
 	 uses raopcld_accept_frames() and tries to send frames even before the
 	 connect has returned in case of multi-threaded application
 	*/
-	if (p->rtp_ports.audio.fd == -1 || p->state != RAOP_STREAMING) return false;
+	if (p->rtp_ports.audio.fd == -1 || p->state != RAOP_STREAMING) return 0;
 
 	addr.sin_family = AF_INET;
 	addr.sin_addr = p->peer_addr;
 	addr.sin_port = htons(p->rtp_ports.audio.rport);
 
-	FD_ZERO(&wfds);
-	FD_SET(p->rtp_ports.audio.fd, &wfds);
+	while (sent < count) {
+		int n;
 
-	/*
-	  The audio socket is non blocking, so we can can wait socket availability
-	  but not too much. Half of the packet size if a good value. There is the
-	  backlog buffer to re-send packets if needed, so nothign is lost
-	*/
-	timeout.tv_sec = 0;
-	timeout.tv_usec = (p->chunk_len * 1000000L) / (p->sample_rate * 2);
+		FD_ZERO(&wfds);
+		FD_SET(p->rtp_ports.audio.fd, &wfds);
+
+		/*
+		  The audio socket is non blocking, so we can can wait socket availability
+		  but not too much. Half of the packet size if a good value. There is the
+		  backlog buffer to re-send packets if needed, so nothign is lost
+		*/
+		timeout.tv_sec = 0;
+		timeout.tv_usec = (p->chunk_len * 1000000L) / (p->sample_rate * 2);
+
+		if (select(p->rtp_ports.audio.fd + 1, NULL, &wfds, NULL, &timeout) == -1) {
+			LOG_ERROR("[%p]: audio socket closed", p);
+			p->sane.audio.select++;
+			METRIC_ADD(p, errors.select, 1);
+		}
+		else p->sane.audio.select = 0;
 
-	if (select(p->rtp_ports.audio.fd + 1, NULL, &wfds, NULL, &timeout) == -1) {
-		LOG_ERROR("[%p]: audio socket closed", p);
-		p->sane.audio.select++;
-	}
-	else p->sane.audio.select = 0;
+		if (!FD_ISSET(p->rtp_ports.audio.fd, &wfds)) {
+			LOG_DEBUG("[%p]: audio socket unavailable (sent %d/%d)", p, sent, count);
+			p->sane.audio.avail++;
+			METRIC_ADD(p, errors.avail, 1);
+			break;
+		}
+
+		p->sane.audio.avail = 0;
+
+		// socket is writable but might not take all, so wait again for the rest
+		n = _raopcl_send_batch(p->rtp_ports.audio.fd, &addr, packets + sent, sizes + sent, count - sent);
 
-	if (FD_ISSET(p->rtp_ports.audio.fd, &wfds)) {
-		n = sendto(p->rtp_ports.audio.fd, (void*) packet, + size, 0, (void*) &addr, sizeof(addr));
-		if (n != size) {
+		if (!n) {
 			LOG_DEBUG("[%p]: error sending audio packet", p);
-			ret = false;
 			p->sane.audio.send++;
+			METRIC_ADD(p, errors.send, 1);
+			break;
 		}
-		else p->sane.audio.send = 0;
-		p->sane.audio.avail = 0;
-	}
-	else {
-		LOG_DEBUG("[%p]: audio socket unavailable", p);
-		ret = false;
-		p->sane.audio.avail++;
+
+		p->sane.audio.send = 0;
+		for (int i = sent; i < sent + n; i++) bytes += sizes[i];
+		sent += n;
 	}
 
-	return ret;
+	METRIC_ADD(p, packets, sent);
+	METRIC_ADD(p, bytes, bytes);
+
+	return sent;
+}
+
+/*----------------------------------------------------------------------------*/
+static bool _raopcl_send_audio(struct raopcl_s *p, rtp_audio_pkt_t *packet, int size)
+{
+	uint8_t *data = (uint8_t*) packet;
+	return _raopcl_send_audio_batch(p, &data, &size, 1) == 1;
 }
 
 /*----------------------------------------------------------------------------*/
@@ -674,6 +1385,8 @@ struct raopcl_s *raopcl_create(struct in_addr host, uint16_t port_base, uint16_t
 		return NULL;
 	}
 
+	pcm_pack_init();
+
 	raopcld = malloc(sizeof(raopcl_data_t));
 	memset(raopcld, 0, sizeof(raopcl_data_t));
 
@@ -697,6 +1410,7 @@ struct raopcl_s *raopcl_create(struct in_addr host, uint16_t port_base, uint16_t
 	strcpy(raopcld->active_remote, active_remote ? active_remote : "");
 	raopcld->host_addr = host;
 	raopcld->rtp_ports.ctrl.fd = raopcld->rtp_ports.time.fd = raopcld->rtp_ports.audio.fd = -1;
+	raopcld->tick_fd = -1;
 	raopcld->seq_number = rand();
 
 	if (md && strchr(md, '0')) raopcld->md_caps |= MD_TEXT;
@@ -715,6 +1429,25 @@ struct raopcl_s *raopcl_create(struct in_addr host, uint16_t port_base, uint16_t
 		raopcld->codec = RAOP_ALAC_RAW;
 	}
 
+	// all backlog buffers are allocated once, with room for re-transmit header
+	raopcld->slot_size = sizeof(rtp_header_t) + sizeof(rtp_audio_pkt_t) + chunk_len * 4 + MAX_PAYLOAD_OVERHEAD;
+	raopcld->slot_size = (raopcld->slot_size + 15) & ~15;
+
+	raopcld->arena = malloc(MAX_BACKLOG * raopcld->slot_size);
+	raopcld->scratch = malloc(MAX_BATCH * raopcld->slot_size);
+
+	if (!raopcld->arena || !raopcld->scratch) {
+		LOG_ERROR("[%p]: Cannot allocate backlog", raopcld);
+		free(raopcld->arena);
+		free(raopcld->scratch);
+		if (raopcld->alac_codec) alac_delete_encoder(raopcld->alac_codec);
+		rtspcl_destroy(raopcld->rtspcl);
+		free(raopcld);
+		return NULL;
+	}
+
+	for (int i = 0; i < MAX_BACKLOG; i++) raopcld->backlog[i].buffer = raopcld->arena + i * raopcld->slot_size;
+
 	LOG_INFO("[%p]: using %s coding", raopcld, raopcld->alac_codec ? "ALAC" : "PCM");
 
 	pthread_mutex_init(&raopcld->mutex, NULL);
@@ -724,7 +1457,11 @@ struct raopcl_s *raopcl_create(struct in_addr host, uint16_t port_base, uint16_t
 	RAND_bytes(raopcld->key, sizeof(raopcld->key));
 	VALGRIND_MAKE_MEM_DEFINED(raopcld->key, sizeof(raopcld->key));
 
-	aes_set_key(&raopcld->ctx, raopcld->key, 128);
+	if (!aes_cbc_init(&raopcld->cbc, raopcld->key, raopcld->iv, true)) {
+		LOG_WARN("[%p]: cannot use accelerated AES", raopcld);
+	}
+
+	LOG_INFO("[%p]: using %s for AES-CBC", raopcld, aes_cbc_backend(&raopcld->cbc));
 
 	raopcl_sanitize(raopcld);
 
@@ -734,12 +1471,24 @@ struct raopcl_s *raopcl_create(struct in_addr host, uint16_t port_base, uint16_t
 /*----------------------------------------------------------------------------*/
 static void _raopcl_terminate_rtp(struct raopcl_s *p)
 {
-	// Terminate RTP threads and close sockets
-	p->ctrl_running = false;
-	pthread_join(p->ctrl_thread, NULL);
-
-	p->time_running = false;
-	pthread_join(p->time_thread, NULL);
+	// Terminate RTP threads (or leave reactor) and close sockets
+	if (p->reactor) {
+		if (p->ctrl_running) {
+			raop_reactor_remove(p->reactor, p->tick_fd);
+			raop_reactor_remove(p->reactor, p->rtp_ports.ctrl.fd);
+		}
+		if (p->time_running) raop_reactor_remove(p->reactor, p->rtp_ports.time.fd);
+		if (p->keepalive.started) pthread_join(p->keepalive.thread, NULL);
+		p->keepalive.started = false;
+		p->ctrl_running = p->time_running = false;
+		p->tick_fd = -1;
+	} else {
+		p->ctrl_running = false;
+		pthread_join(p->ctrl_thread, NULL);
+
+		p->time_running = false;
+		pthread_join(p->time_thread, NULL);
+	}
 
 	if (p->rtp_ports.ctrl.fd != -1) closesocket(p->rtp_ports.ctrl.fd);
 	if (p->rtp_ports.time.fd != -1) closesocket(p->rtp_ports.time.fd);
@@ -988,6 +1737,8 @@ bool raopcl_connect(struct raopcl_s *p, struct in_addr peer, uint16_t destport,
 	p->encrypt = (p->crypto != RAOP_CLEAR);
 	memset(&p->sane, 0, sizeof(p->sane));
 	p->retransmit = 0;
+	for (size_t i = 0; i < sizeof(p->metrics) / sizeof(*p->metrics); i++) atomic_store(p->metrics + i, 0);
+	p->last_sync = 0;
 
 	RAND_bytes((uint8_t*) &seed, sizeof(seed));
 	VALGRIND_MAKE_MEM_DEFINED(&seed, sizeof(seed));
@@ -1033,8 +1784,21 @@ bool raopcl_connect(struct raopcl_s *p, struct in_addr peer, uint16_t destport,
 
 	if (p->rtp_ports.time.fd < 0) goto erexit;
 
+#if LINUX
+	{
+		int on = 1;
+		if (setsockopt(p->rtp_ports.time.fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) < 0) {
+			LOG_WARN("[%p]: no kernel timestamps on timing socket %s", p, strerror(errno));
+		}
+	}
+#endif
+
+	p->ntp_rport = 0;
 	p->time_running = true;
-	pthread_create(&p->time_thread, NULL, _rtp_timing_thread, (void*) p);
+
+	if (p->reactor) {
+		if (!raop_reactor_add(p->reactor, p->rtp_ports.time.fd, _raopcl_reactor_cb, p)) goto erexit;
+	} else pthread_create(&p->time_thread, NULL, _rtp_timing_thread, (void*) p);
 
 	// RTSP ANNOUNCE
 	if (p->auth && p->crypto) {
@@ -1078,7 +1842,11 @@ bool raopcl_connect(struct raopcl_s *p, struct in_addr peer, uint16_t destport,
 	kd_free(kd);
 
 	p->ctrl_running = true;
-	pthread_create(&p->ctrl_thread, NULL, _rtp_control_thread, (void*) p);
+
+	if (p->reactor) {
+		if (!raop_reactor_add(p->reactor, p->rtp_ports.ctrl.fd, _raopcl_reactor_cb, p)) goto erexit;
+		p->tick_fd = raop_reactor_add_timer(p->reactor, 1000, _raopcl_reactor_cb, p);
+	} else pthread_create(&p->ctrl_thread, NULL, _rtp_control_thread, (void*) p);
 
 	pthread_mutex_lock(&p->mutex);
 	// as connect might take time, state might already have been set
@@ -1183,20 +1951,21 @@ bool raopcl_repair(struct raopcl_s *p, bool set_volume)
 /*----------------------------------------------------------------------------*/
 bool raopcl_destroy(struct raopcl_s *p)
 {
-	int i;
 	bool rc;
 
 	if (!p) return false;
 
+	raopcl_stop_push(p);
+	raopcl_group_remove(p->group, p);
+
 	rc = raopcl_disconnect(p);
 	rc &= rtspcl_destroy(p->rtspcl);
 	pthread_mutex_destroy(&p->mutex);
 
-	for (i = 0; i < MAX_BACKLOG; i++) {
-		if (p->backlog[i].buffer) {
-			free(p->backlog[i].buffer);
-		}
-	}
+	free(p->arena);
+	free(p->scratch);
+
+	aes_cbc_free(&p->cbc);
 
 	if (p->alac_codec) alac_delete_encoder(p->alac_codec);
 
@@ -1259,6 +2028,10 @@ void _raopcl_send_sync(struct raopcl_s *raopcld, bool first)
 
 	n = sendto(raopcld->rtp_ports.ctrl.fd, (void*) &rsp, sizeof(rsp), 0, (void*) &addr, sizeof(addr));
 
+	// first sync is a restart, not an interval
+	if (!first && raopcld->last_sync) raop_hist_add(raopcld->metrics + METRIC(sync), gettime_us() - raopcld->last_sync);
+	raopcld->last_sync = gettime_us();
+
 	if (!first) pthread_mutex_unlock(&raopcld->mutex);
 
 	LOG_DEBUG("[%p]: sync ntp:%u.%u (ts:%" PRIu64 ")", raopcld, RAOP_SEC(now), RAOP_FRAC(now), raopcld->head_ts);
@@ -1267,27 +2040,138 @@ void _raopcl_send_sync(struct raopcl_s *raopcld, bool first)
 	if (n == 0) LOG_INFO("[%p]: write, disconnected on the other end", raopcld);
 }
 
+/*----------------------------------------------------------------------------*/
+bool raopcl_attach_reactor(struct raopcl_s *p, struct raop_reactor_s *reactor)
+{
+	if (!p) return false;
+
+	// can't move sockets between threads and reactor while they are used
+	if (p->time_running || p->ctrl_running) {
+		LOG_ERROR("[%p]: can't attach reactor while connected", p);
+		return false;
+	}
+
+	p->reactor = reactor;
+
+	return true;
+}
+
+/*----------------------------------------------------------------------------*/
+static void _raopcl_reactor_cb(void *owner, int fd)
+{
+	raopcl_data_t *raopcld = (raopcl_data_t*) owner;
+
+	if (fd == raopcld->rtp_ports.time.fd) _raopcl_handle_time(raopcld);
+	else if (fd == raopcld->rtp_ports.ctrl.fd) _raopcl_handle_ctrl(raopcld);
+	else if (fd == raopcld->tick_fd) _raopcl_tick(raopcld);
+}
+
+/*----------------------------------------------------------------------------*/
+static int _raopcl_handle_time(struct raopcl_s *raopcld)
+{
+	rtp_time_pkt_t req;
+	struct sockaddr_in addr, client;
+	struct ntp_s recv_time, send_time;
+	uint64_t now, age = 0;
+	int n;
+#if LINUX
+	char control[CMSG_SPACE(sizeof(struct timespec))];
+	struct iovec iov = { &req, sizeof(req) };
+	struct msghdr msg = { 0 };
+
+	msg.msg_name = &client;
+	msg.msg_namelen = sizeof(client);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	n = recvmsg(raopcld->rtp_ports.time.fd, &msg, 0);
+	now = gettime_us();
+
+	/*
+	 Kernel stamped the packet when it arrived, so time spent waiting for us
+	 to be scheduled is not counted as network delay. Stamp is wall clock, so
+	 only its age is used, whatever clock gettime_us() uses
+	*/
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); n > 0 && cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		struct timespec stamp, real;
+
+		if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_TIMESTAMPNS) continue;
+
+		memcpy(&stamp, CMSG_DATA(cmsg), sizeof(stamp));
+		clock_gettime(CLOCK_REALTIME, &real);
+		age = max((real.tv_sec - stamp.tv_sec) * 1000000LL + (real.tv_nsec - stamp.tv_nsec) / 1000, 0);
+	}
+#else
+	int len = sizeof(client);
+
+	n = recvfrom(raopcld->rtp_ports.time.fd, (void*) &req, sizeof(req), 0, (struct sockaddr *)&client, (socklen_t *)&len);
+	now = gettime_us();
+#endif
+
+	if (!raopcld->ntp_rport && n > 0) {
+		raopcld->ntp_rport = ntohs(client.sin_port);
+		LOG_DEBUG("[%p]: NTP remote port: %d", raopcld, raopcld->ntp_rport);
+	}
+
+	if( n > 0) 	{
+		rtp_time_pkt_t rsp;
+
+		addr.sin_family = AF_INET;
+		addr.sin_addr = raopcld->peer_addr;
+		addr.sin_port = htons(raopcld->ntp_rport);
+
+		rsp.hdr = req.hdr;
+		rsp.hdr.type = 0x53 | 0x80;
+		// just copy the request header or set seq=7 and timestamp=0
+		rsp.ref_time = req.send_time;
+		VALGRIND_MAKE_MEM_DEFINED(&rsp, sizeof(rsp));
+
+		// transform into NTP and set network order, send time is read as late as possible
+		_raopcl_us_to_ntp(now - age, &recv_time);
+		rsp.recv_time.seconds = htonl(recv_time.seconds);
+		rsp.recv_time.fraction = htonl(recv_time.fraction);
+		raopcl_get_ntp(&send_time);
+		rsp.send_time.seconds = htonl(send_time.seconds);
+		rsp.send_time.fraction = htonl(send_time.fraction);
+
+		n = sendto(raopcld->rtp_ports.time.fd, (void*) &rsp, sizeof(rsp), 0, (void*) &addr, sizeof(addr));
+
+		if (n != (int) sizeof(rsp)) {
+		   LOG_ERROR("[%p]: error responding to sync", raopcld);
+		}
+
+		LOG_DEBUG( "[%p]: NTP sync: %u.%u (ref %u.%u, held %" PRIu64 " us)", raopcld, ntohl(rsp.send_time.seconds), ntohl(rsp.send_time.fraction),
+														ntohl(rsp.ref_time.seconds), ntohl(rsp.ref_time.fraction), age + gettime_us() - now);
+
+	}
+
+	if (n < 0) {
+	   LOG_ERROR("[%p]: read error: %s", raopcld, strerror(errno));
+	}
+
+	if (n == 0) {
+		LOG_ERROR("[%p]: read, disconnected on the other end", raopcld);
+	}
+
+	return n;
+}
+
 /*----------------------------------------------------------------------------*/
 void *_rtp_timing_thread(void *args)
 {
 	raopcl_data_t *raopcld = (raopcl_data_t*) args;
-	struct sockaddr_in addr;
-
-	addr.sin_family = AF_INET;
-	addr.sin_addr = raopcld->peer_addr;
-	addr.sin_port = htons(raopcld->rtp_ports.time.rport);
 
 	while (raopcld->time_running)
 	{
-		rtp_time_pkt_t req;
 		struct timeval timeout = { 1, 0 };
 		fd_set rfds;
-		int n;
 
 		FD_ZERO(&rfds);
 		FD_SET(raopcld->rtp_ports.time.fd, &rfds);
 
-		if ((n = select(raopcld->rtp_ports.time.fd + 1, &rfds, NULL, NULL, &timeout)) == -1) {
+		if (select(raopcld->rtp_ports.time.fd + 1, &rfds, NULL, NULL, &timeout) == -1) {
 			LOG_ERROR("[%p]: raopcl_time_connect: socket closed on the other end", raopcld);
 			usleep(100000);
 			continue;
@@ -1295,63 +2179,142 @@ void *_rtp_timing_thread(void *args)
 
 		if (!FD_ISSET(raopcld->rtp_ports.time.fd, &rfds)) continue;
 
-		if (addr.sin_port) {
-			n = recv(raopcld->rtp_ports.time.fd, (void*) &req, sizeof(req), 0);
-		}
-		else {
-			struct sockaddr_in client;
-			int len = sizeof(client);
-			n = recvfrom(raopcld->rtp_ports.time.fd, (void*) &req, sizeof(req), 0, (struct sockaddr *)&client, (socklen_t *)&len);
-			addr.sin_port = client.sin_port;
-			LOG_DEBUG("[%p]: NTP remote port: %d", raopcld, ntohs(addr.sin_port));
-		}
+		if (_raopcl_handle_time(raopcld) == 0) usleep(100000);
+	}
 
-		if( n > 0) 	{
-			rtp_time_pkt_t rsp;
-
-			rsp.hdr = req.hdr;
-			rsp.hdr.type = 0x53 | 0x80;
-			// just copy the request header or set seq=7 and timestamp=0
-			rsp.ref_time = req.send_time;
-			VALGRIND_MAKE_MEM_DEFINED(&rsp, sizeof(rsp));
-
-			// transform timeval into NTP and set network order
-#ifdef __GNUC__
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Waddress-of-packed-member"
-			raopcl_get_ntp(&rsp.recv_time);
-#pragma GCC diagnostic pop
-#else
-			raopcl_get_ntp(&rsp.recv_time);
-#endif
+	return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+static void _raopcl_tick(struct raopcl_s *raopcld)
+{
+	uint64_t now = raopcl_get_ntp(NULL);
+
+	// Send keepalive packet every 25 seconds, but a slow player shall not block reactor
+	if (now - raopcld->last_keepalive >= MS2NTP(25000) && !atomic_load(&raopcld->keepalive.busy)) {
+		if (raopcld->keepalive.started) pthread_join(raopcld->keepalive.thread, NULL);
+		atomic_store(&raopcld->keepalive.busy, true);
+		raopcld->keepalive.started = true;
+		pthread_create(&raopcld->keepalive.thread, NULL, _raopcl_keepalive_thread, (void*) raopcld);
+		raopcld->last_keepalive = now;
+	}
 
-			rsp.recv_time.seconds = htonl(rsp.recv_time.seconds);
-			rsp.recv_time.fraction = htonl(rsp.recv_time.fraction);
-			rsp.send_time = rsp.recv_time; // might need to add a few fraction ?
+	_raopcl_send_sync(raopcld, false);
+}
 
-			n = sendto(raopcld->rtp_ports.time.fd, (void*) &rsp, sizeof(rsp), 0, (void*) &addr, sizeof(addr));
+/*----------------------------------------------------------------------------*/
+static void *_raopcl_keepalive_thread(void *args)
+{
+	struct raopcl_s *raopcld = (struct raopcl_s*) args;
 
-			if (n != (int) sizeof(rsp)) {
-			   LOG_ERROR("[%p]: error responding to sync", raopcld);
-			}
+	LOG_INFO("[%p]: sending keepalive packet", raopcld);
+	raopcl_keepalive(raopcld);
+	atomic_store(&raopcld->keepalive.busy, false);
+
+	return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+static void _raopcl_handle_ctrl(struct raopcl_s *raopcld)
+{
+	rtp_lost_pkt_t lost;
+	struct sockaddr_in addr;
+	int i, n, missed, count, sent;
+	uint8_t *packets[MAX_BATCH];
+	int sizes[MAX_BATCH];
+
+	n = recv(raopcld->rtp_ports.ctrl.fd, (void*) &lost, sizeof(lost), 0);
 
-			LOG_DEBUG( "[%p]: NTP sync: %u.%u (ref %u.%u)", raopcld, ntohl(rsp.send_time.seconds), ntohl(rsp.send_time.fraction),
-															ntohl(rsp.ref_time.seconds), ntohl(rsp.ref_time.fraction) );
+	if (n < 0) return;
 
+	lost.seq_number = ntohs(lost.seq_number);
+	lost.n = ntohs(lost.n);
+
+	if (n != sizeof(lost)) {
+		LOG_ERROR("[%p]: error in received request sn:%d n:%d (recv:%d)",
+				  raopcld, lost.seq_number, lost.n, n);
+		lost.n = 0;
+		lost.seq_number = 0;
+		raopcld->sane.ctrl++;
+	}
+	else raopcld->sane.ctrl = 0;
+
+	METRIC_ADD(raopcld, nack.requests, 1);
+	METRIC_ADD(raopcld, nack.packets, lost.n);
+
+	// no need to look beyond what the backlog can hold
+	if (lost.n > MAX_BACKLOG) {
+		LOG_WARN("[%p]: lost packets out of backlog %u-%u", raopcld, lost.seq_number, lost.seq_number + lost.n - MAX_BACKLOG - 1);
+		METRIC_ADD(raopcld, out_of_backlog, lost.n - MAX_BACKLOG);
+		lost.seq_number += lost.n - MAX_BACKLOG;
+		lost.n = MAX_BACKLOG;
+	}
+
+	addr.sin_family = AF_INET;
+	addr.sin_addr = raopcld->peer_addr;
+	addr.sin_port = htons(raopcld->rtp_ports.ctrl.rport);
+
+	/*
+	 No mutex here, slots are copied in scratch under their seqlock and sent by
+	 batches from there. A slot being re-written means that the packet is gone
+	*/
+	for (sent = count = missed = 0, i = 0; i < lost.n; i++) {
+		uint16_t seq_number = lost.seq_number + i, index = seq_number % MAX_BACKLOG;
+		uint8_t *buffer = raopcld->scratch + count * raopcld->slot_size;
+		rtp_header_t *hdr = (rtp_header_t*) buffer;
+		unsigned lock = atomic_load_explicit(&raopcld->backlog[index].lock, memory_order_acquire);
+		int size = raopcld->backlog[index].size;
+		bool found = raopcld->backlog[index].seq_number == seq_number;
+
+		if (found && size && !(lock & 1)) memcpy(buffer + sizeof(rtp_header_t), raopcld->backlog[index].buffer + sizeof(rtp_header_t), size);
+
+		atomic_thread_fence(memory_order_acquire);
+
+		if (lock != atomic_load_explicit(&raopcld->backlog[index].lock, memory_order_relaxed) || (lock & 1)) {
+			// packet is being released right now, be extra cautious
+			missed++;
+			continue;
 		}
 
-		if (n < 0) {
-		   LOG_ERROR("[%p]: read error: %s", raopcld, strerror(errno));
+		if (!found) {
+			LOG_WARN("[%p]: lost packet out of backlog %u", raopcld, seq_number);
+			METRIC_ADD(raopcld, out_of_backlog, 1);
+			continue;
 		}
 
-		if (n == 0) {
-			LOG_ERROR("[%p]: read, disconnected on the other end", raopcld);
-			usleep(100000);
+		if (!size) {
+			missed++;
 			continue;
 		}
+
+		hdr->proto = 0x80;
+		hdr->type = 0x56 | 0x80;
+		hdr->seq[0] = 0;
+		hdr->seq[1] = 1;
+
+		packets[count] = buffer;
+		sizes[count++] = sizeof(rtp_header_t) + size;
+
+		// scratch is full, send it all in one batch
+		if (count == MAX_BATCH) {
+			n = _raopcl_send_batch(raopcld->rtp_ports.ctrl.fd, &addr, packets, sizes, count);
+			if (n != count) {
+				LOG_WARN("[%p]: error resending lost packets sn:%u (sent:%d/%d)", raopcld, seq_number, n, count);
+			}
+			sent += n;
+			count = 0;
+		}
 	}
 
-	return NULL;
+	// and what remains
+	if (count) sent += _raopcl_send_batch(raopcld->rtp_ports.ctrl.fd, &addr, packets, sizes, count);
+
+	raopcld->retransmit += sent;
+	METRIC_ADD(raopcld, retransmit.nack, sent);
+	METRIC_ADD(raopcld, missed, missed);
+
+	LOG_DEBUG("[%p]: retransmit packet sn:%d nb:%d (mis:%d)",
+			  raopcld, lost.seq_number, lost.n, missed);
 }
 
 /*----------------------------------------------------------------------------*/
@@ -1384,70 +2347,7 @@ void *_rtp_control_thread(void *args)
 		}
 
 		if (FD_ISSET(raopcld->rtp_ports.ctrl.fd, &rfds)) {
-			rtp_lost_pkt_t lost;
-			int i, n, missed;
-
-			n = recv(raopcld->rtp_ports.ctrl.fd, (void*) &lost, sizeof(lost), 0);
-
-			if (n < 0) continue;
-
-			lost.seq_number = ntohs(lost.seq_number);
-			lost.n = ntohs(lost.n);
-
-			if (n != sizeof(lost)) {
-				LOG_ERROR("[%p]: error in received request sn:%d n:%d (recv:%d)",
-						  raopcld, lost.seq_number, lost.n, n);
-				lost.n = 0;
-				lost.seq_number = 0;
-				raopcld->sane.ctrl++;
-			}
-			else raopcld->sane.ctrl = 0;
-
-			pthread_mutex_lock(&raopcld->mutex);
-
-			for (missed = 0, i = 0; i < lost.n; i++) {
-				uint16_t index = (lost.seq_number + i) % MAX_BACKLOG;
-
-				if (raopcld->backlog[index].seq_number == lost.seq_number + i) {
-					struct sockaddr_in addr;
-					rtp_header_t *hdr = (rtp_header_t*) raopcld->backlog[index].buffer;
-
-					// packet have been released meanwhile, be extra cautious
-					if (!hdr) {
-						missed++;
-						continue;
-					}
-
-					hdr->proto = 0x80;
-					hdr->type = 0x56 | 0x80;
-					hdr->seq[0] = 0;
-					hdr->seq[1] = 1;
-
-					addr.sin_family = AF_INET;
-					addr.sin_addr = raopcld->peer_addr;
-					addr.sin_port = htons(raopcld->rtp_ports.ctrl.rport);
-
-					raopcld->retransmit++;
-
-					n = sendto(raopcld->rtp_ports.ctrl.fd, (void*) hdr,
-							   sizeof(rtp_header_t) + raopcld->backlog[index].size,
-							   0, (void*) &addr, sizeof(addr));
-
-					if (n == -1) {
-						LOG_WARN("[%p]: error resending lost packet sn:%u (n:%d)",
-								   raopcld, lost.seq_number + i, n);
-					}
-				}
-				else {
-					LOG_WARN("[%p]: lost packet out of backlog %u", raopcld, lost.seq_number + i);
-				}
-			}
-
-			pthread_mutex_unlock(&raopcld->mutex);
-
-			LOG_DEBUG("[%p]: retransmit packet sn:%d nb:%d (mis:%d)",
-					  raopcld, lost.seq_number, lost.n, missed);
-
+			_raopcl_handle_ctrl(raopcld);
 			continue;
 		}
 
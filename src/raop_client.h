@@ -61,6 +61,7 @@
 */
 
 #include "platform.h"
+#include "raop_hist.h"
 
 #define DEFAULT_FRAMES_PER_CHUNK 352
 #define MAX_FRAMES_PER_CHUNK 4096 // must match alac_wrapper.h ALAC_MAX_FRAMES
@@ -147,6 +148,49 @@ bool 	 raopcl_set_artwork(struct raopcl_s *p, char *content_type, int size, char
 bool 	raopcl_accept_frames(struct raopcl_s *p);
 bool	raopcl_send_chunk(struct raopcl_s *p, uint8_t *sample, int size, uint64_t *playtime);
 
+/*
+ A group encodes each chunk once and shares the payload between its members,
+ which only do their own RTP header, encryption and send. Members must use the
+ same codec, chunk length and sample rate as the group and keep their own state
+ and latency, so they still must be connected, flushed, paused... individually.
+ Use raopcl_group_accept_frames/send_chunk instead of the per-player ones.
+ Chunks are only accepted when all connected members can take them, so one
+ that is flushing or paused holds the whole group. Members that are not
+ connected are skipped. A player can be in one group only and leaves it when
+ destroyed. The return value is the number of connected members, which all
+ got the chunk, and playtime is the one of the first of them
+*/
+struct raopcl_group_s;
+
+struct raopcl_group_s *raopcl_group_create(raop_codec_t codec, int frame_len,
+										   int sample_rate, int sample_size, int channels);
+void	raopcl_group_destroy(struct raopcl_group_s *g);
+bool	raopcl_group_add(struct raopcl_group_s *g, struct raopcl_s *p);
+bool	raopcl_group_remove(struct raopcl_group_s *g, struct raopcl_s *p);
+bool	raopcl_group_accept_frames(struct raopcl_group_s *g);
+int		raopcl_group_send_chunk(struct raopcl_group_s *g, uint8_t *sample, int frames, uint64_t *playtime);
+
+/*
+ Instead of pacing with raopcl_accept_frames/raopcl_send_chunk, a producer can
+ push audio (16 bits stereo) into a lock-free ring from which a pacing thread
+ sends chunks at the right time. raopcl_push_frames never waits for room and
+ returns the number of frames it accepted (it only takes a lock to wake up the
+ pacer when the ring was empty). Only one thread can push
+*/
+bool		raopcl_start_push(struct raopcl_s *p, uint32_t frames);
+void		raopcl_stop_push(struct raopcl_s *p);
+uint32_t	raopcl_push_frames(struct raopcl_s *p, uint8_t *sample, uint32_t frames);
+uint32_t	raopcl_push_space(struct raopcl_s *p);
+
+/*
+ By default, each connected player has its own timing and control threads. To
+ serve many players, they can instead share a reactor (see raop_reactor.h) that
+ must be attached before raopcl_connect and outlive the player's connection
+*/
+struct raop_reactor_s;
+
+bool	raopcl_attach_reactor(struct raopcl_s *p, struct raop_reactor_s *reactor);
+
 bool 	raopcl_start_at(struct raopcl_s *p, uint64_t start_time);
 void 	raopcl_pause(struct raopcl_s *p);
 void 	raopcl_stop(struct raopcl_s *p);
@@ -166,6 +210,29 @@ bool 	raopcl_is_connected(struct raopcl_s *p);
 bool 	raopcl_is_playing(struct raopcl_s *p);
 bool 	raopcl_sanitize(struct raopcl_s *p);
 
+/*
+ Metrics of a player since it has been connected, counters never go down (see
+ raop_hist.h for histograms). raopcl_metrics takes a lock-free snapshot of them
+ and raopcl_metrics_print renders count snapshots together as Prometheus text
+ (each metric once, with a sample per player) or as a JSON array. names are used
+ as "player" label, the array or any of them can be NULL. It returns what
+ snprintf would
+*/
+typedef struct {
+	uint64_t packets, bytes;						// sent on audio port, including replays at resume
+	struct { uint64_t nack, resume; } retransmit;
+	struct { uint64_t requests, packets; } nack;	// received from player
+	uint64_t out_of_backlog, missed;				// requested but gone or being overwritten
+	struct { uint64_t select, avail, send; } errors;
+	raop_hist_t encode, lock, sync;				// lock is time mutex is held per chunk
+} raopcl_metrics_t;
+
+typedef enum { RAOPCL_METRICS_PROMETHEUS, RAOPCL_METRICS_JSON } raopcl_metrics_format_t;
+
+bool	raopcl_metrics(struct raopcl_s *p, raopcl_metrics_t *metrics);
+int		raopcl_metrics_print(raopcl_metrics_t *metrics, char **names, int count, raopcl_metrics_format_t format,
+							 char *buf, size_t size);
+
 uint64_t 	raopcl_time32_to_ntp(uint32_t time);
 
 struct mdnssd_handle_s;
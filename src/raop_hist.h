@@ -0,0 +1,23 @@
+/*
+ * RAOP: latency histograms of player metrics and receiver statistics
+ *
+ * (c) Philippe, philippe_44@outlook.com
+ *
+ * See LICENSE
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/*
+ Values are in us, bucket i counts values below 2^(i+1) and the last one counts
+ all the rest
+*/
+#define RAOP_HIST_BUCKETS	24
+
+typedef struct {
+	uint64_t count, sum;
+	uint64_t buckets[RAOP_HIST_BUCKETS];
+} raop_hist_t;
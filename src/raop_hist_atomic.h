@@ -0,0 +1,32 @@
+/*
+ * RAOP: lock-free updates of latency histograms
+ *
+ * (c) Philippe, philippe_44@outlook.com
+ *
+ * See LICENSE
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+#include "raop_hist.h"
+
+/*
+ Structures holding histograms only have 64 bits members so that they can be
+ updated as an array of atomics, where a histogram starts at index
+ offsetof(..., field) / sizeof(uint64_t)
+*/
+static inline int raop_hist_bucket(uint64_t us) {
+	int bucket;
+	for (bucket = 0; bucket < RAOP_HIST_BUCKETS - 1 && (us >> (bucket + 1)); bucket++);
+	return bucket;
+}
+
+static inline void raop_hist_add(atomic_ullong *hist, uint64_t us) {
+	atomic_fetch_add_explicit(hist + offsetof(raop_hist_t, count) / sizeof(uint64_t), 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(hist + offsetof(raop_hist_t, sum) / sizeof(uint64_t), us, memory_order_relaxed);
+	atomic_fetch_add_explicit(hist + offsetof(raop_hist_t, buckets) / sizeof(uint64_t) + raop_hist_bucket(us), 1, memory_order_relaxed);
+}
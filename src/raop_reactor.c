@@ -0,0 +1,356 @@
+/*
+ * RAOP: shared event loop for RTP sockets and timers
+ *
+ * (c) Philippe, philippe_44@outlook.com
+ *
+ * See LICENSE
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "platform.h"
+#include "raop_reactor.h"
+
+#include "cross_net.h"
+#include "cross_log.h"
+
+#if LINUX
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#endif
+
+#define MAX_REACTOR_THREADS	8
+
+extern log_level	raop_loglevel;
+static log_level 	*loglevel = &raop_loglevel;
+
+#if LINUX
+
+/*
+ Events carry the fd and an id, not a pointer, so that an event already fetched
+ by a thread for an entry that has been removed meanwhile is simply ignored. Ids
+ are not re-used (until they wrap) and entries are in a table indexed by fd
+*/
+#define REACTOR_EVENT(id, fd)	(((uint64_t) (id) << 32) | (uint32_t) (fd))
+
+typedef struct reactor_entry_s {
+	uint32_t id;
+	int fd;
+	bool timer, busy, dead, orphan;
+	pthread_t thread;
+	raop_reactor_cb_t cb;
+	void *owner;
+} reactor_entry_t;
+
+typedef struct raop_reactor_s {
+	int efd, wake_fd;
+	bool running;
+	int nb_threads;
+	pthread_t threads[MAX_REACTOR_THREADS];
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	uint32_t next_id;
+	int size;
+	reactor_entry_t **entries;	// by fd
+} raop_reactor_t;
+
+static void *_reactor_thread(void *args);
+
+/*----------------------------------------------------------------------------*/
+struct raop_reactor_s *raop_reactor_create(int threads)
+{
+	struct epoll_event ev = { 0 };
+	raop_reactor_t *r = malloc(sizeof(raop_reactor_t));
+
+	memset(r, 0, sizeof(raop_reactor_t));
+
+	r->efd = epoll_create1(EPOLL_CLOEXEC);
+	r->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+	if (r->efd < 0 || r->wake_fd < 0) {
+		LOG_ERROR("[%p]: cannot create reactor %s", r, strerror(errno));
+		if (r->efd >= 0) close(r->efd);
+		if (r->wake_fd >= 0) close(r->wake_fd);
+		free(r);
+		return NULL;
+	}
+
+	// wake-up is level triggered and never read, so it wakes every thread
+	ev.events = EPOLLIN;
+	ev.data.u64 = 0;
+	epoll_ctl(r->efd, EPOLL_CTL_ADD, r->wake_fd, &ev);
+
+	pthread_mutex_init(&r->mutex, NULL);
+	pthread_cond_init(&r->cond, NULL);
+	r->next_id = 1;
+	r->running = true;
+	r->nb_threads = min(max(threads, 1), MAX_REACTOR_THREADS);
+
+	for (int i = 0; i < r->nb_threads; i++) {
+		pthread_create(&r->threads[i], NULL, _reactor_thread, (void*) r);
+	}
+
+	LOG_INFO("[%p]: reactor created with %d threads", r, r->nb_threads);
+
+	return r;
+}
+
+/*----------------------------------------------------------------------------*/
+void raop_reactor_destroy(struct raop_reactor_s *r)
+{
+	uint64_t one = 1;
+
+	if (!r) return;
+
+	r->running = false;
+	if (write(r->wake_fd, &one, sizeof(one)) < 0) LOG_WARN("[%p]: cannot wake reactor", r);
+
+	for (int i = 0; i < r->nb_threads; i++) pthread_join(r->threads[i], NULL);
+
+	for (int fd = 0; fd < r->size; fd++) {
+		reactor_entry_t *entry = r->entries[fd];
+		if (!entry) continue;
+		LOG_WARN("[%p]: fd %d still in reactor", r, fd);
+		if (entry->timer) close(fd);
+		free(entry);
+	}
+
+	free(r->entries);
+
+	close(r->wake_fd);
+	close(r->efd);
+	pthread_cond_destroy(&r->cond);
+	pthread_mutex_destroy(&r->mutex);
+
+	free(r);
+}
+
+/*----------------------------------------------------------------------------*/
+static bool _reactor_add(struct raop_reactor_s *r, int fd, bool timer, raop_reactor_cb_t cb, void *owner)
+{
+	struct epoll_event ev = { 0 };
+	reactor_entry_t *entry = malloc(sizeof(reactor_entry_t));
+
+	memset(entry, 0, sizeof(reactor_entry_t));
+	entry->fd = fd;
+	entry->timer = timer;
+	entry->cb = cb;
+	entry->owner = owner;
+
+	pthread_mutex_lock(&r->mutex);
+
+	// table grows with highest fd, it's never shrunk
+	if (fd >= r->size) {
+		int size = max(fd + 1, r->size * 2);
+		r->entries = realloc(r->entries, size * sizeof(reactor_entry_t*));
+		memset(r->entries + r->size, 0, (size - r->size) * sizeof(reactor_entry_t*));
+		r->size = size;
+	}
+
+	// 0 is the wake-up event
+	if (!++r->next_id) r->next_id++;
+	entry->id = r->next_id;
+	ev.events = EPOLLIN | EPOLLONESHOT;
+	ev.data.u64 = REACTOR_EVENT(entry->id, fd);
+
+	if (r->entries[fd] || epoll_ctl(r->efd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		bool exists = r->entries[fd] != NULL;
+		pthread_mutex_unlock(&r->mutex);
+		LOG_ERROR("[%p]: cannot add fd %d %s", r, fd, exists ? "already in reactor" : strerror(errno));
+		free(entry);
+		return false;
+	}
+
+	r->entries[fd] = entry;
+
+	pthread_mutex_unlock(&r->mutex);
+
+	return true;
+}
+
+/*----------------------------------------------------------------------------*/
+bool raop_reactor_add(struct raop_reactor_s *r, int fd, raop_reactor_cb_t cb, void *owner)
+{
+	if (!r || fd < 0 || !cb) return false;
+	return _reactor_add(r, fd, false, cb, owner);
+}
+
+/*----------------------------------------------------------------------------*/
+int raop_reactor_add_timer(struct raop_reactor_s *r, uint32_t period_ms, raop_reactor_cb_t cb, void *owner)
+{
+	struct itimerspec spec;
+	int fd;
+
+	if (!r || !period_ms || !cb) return -1;
+
+	if ((fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0) {
+		LOG_ERROR("[%p]: cannot create timer %s", r, strerror(errno));
+		return -1;
+	}
+
+	spec.it_interval.tv_sec = period_ms / 1000;
+	spec.it_interval.tv_nsec = (period_ms % 1000) * 1000000L;
+	spec.it_value = spec.it_interval;
+	timerfd_settime(fd, 0, &spec, NULL);
+
+	if (!_reactor_add(r, fd, true, cb, owner)) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/*----------------------------------------------------------------------------*/
+bool raop_reactor_remove(struct raop_reactor_s *r, int fd)
+{
+	reactor_entry_t *entry;
+
+	if (!r || fd < 0) return false;
+
+	pthread_mutex_lock(&r->mutex);
+
+	if (fd >= r->size || (entry = r->entries[fd]) == NULL) {
+		pthread_mutex_unlock(&r->mutex);
+		return false;
+	}
+
+	r->entries[fd] = NULL;
+	entry->dead = true;
+	epoll_ctl(r->efd, EPOLL_CTL_DEL, fd, NULL);
+
+	// removed from its own callback, the dispatching thread will release it
+	if (entry->busy && pthread_equal(entry->thread, pthread_self())) {
+		entry->orphan = true;
+		pthread_mutex_unlock(&r->mutex);
+		return true;
+	}
+
+	while (entry->busy) pthread_cond_wait(&r->cond, &r->mutex);
+
+	pthread_mutex_unlock(&r->mutex);
+
+	if (entry->timer) close(entry->fd);
+	free(entry);
+
+	return true;
+}
+
+/*----------------------------------------------------------------------------*/
+static void *_reactor_thread(void *args)
+{
+	raop_reactor_t *r = (raop_reactor_t*) args;
+
+	while (r->running) {
+		struct epoll_event ev;
+		reactor_entry_t *entry = NULL;
+		int fd, n = epoll_wait(r->efd, &ev, 1, -1);
+
+		if (n < 0 && errno != EINTR) {
+			LOG_ERROR("[%p]: epoll error %s", r, strerror(errno));
+			usleep(100000);
+		}
+
+		if (n <= 0 || !ev.data.u64) continue;
+
+		fd = (uint32_t) ev.data.u64;
+
+		pthread_mutex_lock(&r->mutex);
+
+		if (fd < r->size) entry = r->entries[fd];
+
+		// entry is gone (or fd re-used), that's a stale event
+		if (!entry || REACTOR_EVENT(entry->id, fd) != ev.data.u64) {
+			pthread_mutex_unlock(&r->mutex);
+			continue;
+		}
+
+		entry->busy = true;
+		entry->thread = pthread_self();
+
+		pthread_mutex_unlock(&r->mutex);
+
+		// consume timer expirations, handler does not need to care
+		if (entry->timer) {
+			uint64_t expirations;
+			if (read(entry->fd, &expirations, sizeof(expirations)) < 0) expirations = 0;
+		}
+
+		entry->cb(entry->owner, entry->fd);
+
+		pthread_mutex_lock(&r->mutex);
+
+		entry->busy = false;
+
+		// oneshot requires re-arming, unless it has been removed
+		if (!entry->dead) {
+			ev.events = EPOLLIN | EPOLLONESHOT;
+			ev.data.u64 = REACTOR_EVENT(entry->id, entry->fd);
+			epoll_ctl(r->efd, EPOLL_CTL_MOD, entry->fd, &ev);
+		} else if (entry->orphan) {
+			if (entry->timer) close(entry->fd);
+			free(entry);
+		}
+
+		// whoever is removing this entry can now proceed
+		pthread_cond_broadcast(&r->cond);
+		pthread_mutex_unlock(&r->mutex);
+	}
+
+	return NULL;
+}
+
+#else
+
+/*----------------------------------------------------------------------------*/
+struct raop_reactor_s *raop_reactor_create(int threads)
+{
+	LOG_ERROR("reactor is not available on this platform");
+	return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+void raop_reactor_destroy(struct raop_reactor_s *r)
+{
+}
+
+/*----------------------------------------------------------------------------*/
+bool raop_reactor_add(struct raop_reactor_s *r, int fd, raop_reactor_cb_t cb, void *owner)
+{
+	return false;
+}
+
+/*----------------------------------------------------------------------------*/
+int raop_reactor_add_timer(struct raop_reactor_s *r, uint32_t period_ms, raop_reactor_cb_t cb, void *owner)
+{
+	return -1;
+}
+
+/*----------------------------------------------------------------------------*/
+bool raop_reactor_remove(struct raop_reactor_s *r, int fd)
+{
+	return false;
+}
+
+#endif
+
+/*----------------------------------------------------------------------------*/
+bool raop_reactor_set_timeout(int fd, uint32_t ms)
+{
+#if WIN
+	DWORD timeout = ms;
+#else
+	struct timeval timeout = { ms / 1000, (ms % 1000) * 1000 };
+#endif
+	bool rc = !setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, (char*) &timeout, sizeof(timeout));
+	rc &= !setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, (char*) &timeout, sizeof(timeout));
+
+	if (!rc) LOG_WARN("cannot set timeout on %d: %s", fd, strerror(errno));
+	return rc;
+}
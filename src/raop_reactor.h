@@ -0,0 +1,41 @@
+/*
+ * RAOP: shared event loop for RTP sockets and timers
+ *
+ * (c) Philippe, philippe_44@outlook.com
+ *
+ * See LICENSE
+ *
+ */
+
+#pragma once
+
+#include "platform.h"
+
+/*
+ A reactor multiplexes sockets and periodic timers of many RAOP sessions on a
+ small pool of threads, instead of having a few mostly idle threads for each
+ session. A callback for a given fd is never run concurrently with itself, but
+ callbacks of different fds can be run in parallel by the pool.
+
+ Once raop_reactor_remove() returns, the callback is not running and will not
+ be called anymore, unless it is called from that very callback, in which case
+ it will be released when callback returns.
+
+ Only available on Linux (epoll), raop_reactor_create() returns NULL elsewhere
+ so callers shall keep their own threads
+
+ A blocking socket read or written from a callback stalls a pool thread for as
+ long as its peer does. raop_reactor_set_timeout() bounds that for send and recv
+ of a socket, on all platforms
+*/
+
+struct raop_reactor_s;
+
+typedef void (*raop_reactor_cb_t)(void *owner, int fd);
+
+struct raop_reactor_s*	raop_reactor_create(int threads);
+void 					raop_reactor_destroy(struct raop_reactor_s *r);
+bool 					raop_reactor_add(struct raop_reactor_s *r, int fd, raop_reactor_cb_t cb, void *owner);
+int 					raop_reactor_add_timer(struct raop_reactor_s *r, uint32_t period_ms, raop_reactor_cb_t cb, void *owner);
+bool 					raop_reactor_remove(struct raop_reactor_s *r, int fd);
+bool 					raop_reactor_set_timeout(int fd, uint32_t ms);
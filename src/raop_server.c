@@ -16,11 +16,14 @@
 #include "cross_util.h"
 #include "raop_server.h"
 #include "raop_streamer.h"
+#include "raop_reactor.h"
 #include "dmap_parser.h"
 
 #include "cross_net.h"
 #include "cross_log.h"
 
+#define RTSP_STALL_MS	5000	// peer of a connection served by reactor stalling for longer is closed
+
 typedef struct raopsr_s {
 	struct mdns_service *svc;
 	struct mdnsd *svr;
@@ -60,12 +63,23 @@ typedef struct raopsr_s {
 		uint16_t base, range;
 	} ports;
 	int http_length;
+	struct {
+		struct raop_reactor_s *r;
+		int client;				// RTSP connection, listener is not polled meanwhile
+		pthread_mutex_t mutex;
+	} reactor;
+	struct raop_cache_pool_s *cache;
+	struct {
+		pthread_mutex_t mutex;	// session can't go away while read, guards latencies too
+		raop_stats_t totals;	// of sessions that have ended
+	} stats;
 } raopsr_t;
 
 extern log_level	raop_loglevel;
 static log_level 	*loglevel = &raop_loglevel;
 
 static void*	rtsp_thread(void *arg);
+static void 	rtsp_reactor_cb(void *owner, int fd);
 static bool 	handle_rtsp(raopsr_t *ctx, int sock);
 
 static char*	rsa_apply(unsigned char *input, int inlen, int *outlen, int mode);
@@ -73,6 +87,7 @@ static int  	base64_pad(char *src, char **padded);
 static void 	event_cb(void *owner, raopst_event_t event);
 static void 	http_cb(void *owner, struct key_data_s *headers, struct key_data_s *response);
 static void* 	search_remote(void *args);
+static void 	session_end(raopsr_t *ctx);
 
 extern char private_key[];
 
@@ -116,6 +131,9 @@ struct raopsr_s *raopsr_create(struct in_addr host, struct mdnsd *svr, char *nam
 	ctx->drift = drift;
 	ctx->streamer.codec = strdup(stream_codec);
 	ctx->streamer.metadata = stream_metadata;
+	ctx->reactor.client = -1;
+	pthread_mutex_init(&ctx->reactor.mutex, NULL);
+	pthread_mutex_init(&ctx->stats.mutex, NULL);
 
 	// find a free port
 	if (!port_base) port_range = 1;
@@ -130,6 +148,8 @@ struct raopsr_s *raopsr_create(struct in_addr host, struct mdnsd *svr, char *nam
 	if (ctx->sock < 0 || listen(ctx->sock, 1)) {
 		LOG_ERROR("Cannot bind or listen RTSP listener: %s", strerror(errno));
 		closesocket(ctx->sock);
+		pthread_mutex_destroy(&ctx->reactor.mutex);
+		pthread_mutex_destroy(&ctx->stats.mutex);
 		free(ctx);
 		return NULL;
 	}
@@ -190,11 +210,32 @@ void raopsr_update(struct raopsr_s *ctx, char *name, char *model) {
 void raopsr_delete(struct raopsr_s *ctx) {
 	if (!ctx) return;
 
-	ctx->running = false;
-	pthread_join(ctx->thread, NULL);
+	if (ctx->reactor.r) {
+		int sock;
+
+		// listener might be re-added by a closing connection until we're not running
+		pthread_mutex_lock(&ctx->reactor.mutex);
+		ctx->running = false;
+		pthread_mutex_unlock(&ctx->reactor.mutex);
+
+		raop_reactor_remove(ctx->reactor.r, ctx->sock);
+
+		pthread_mutex_lock(&ctx->reactor.mutex);
+		sock = ctx->reactor.client;
+		ctx->reactor.client = -1;
+		pthread_mutex_unlock(&ctx->reactor.mutex);
+
+		if (sock != -1) {
+			raop_reactor_remove(ctx->reactor.r, sock);
+			closesocket(sock);
+		}
+	} else {
+		ctx->running = false;
+		pthread_join(ctx->thread, NULL);
+	}
 
 	raopsr_metadata_free(&ctx->metadata);
-	raopst_end(ctx->ht);
+	session_end(ctx);
 
 #if WIN
 	shutdown(ctx->sock, SD_BOTH);
@@ -216,11 +257,136 @@ void raopsr_delete(struct raopsr_s *ctx) {
 	free(ctx->latencies);
 
 	mdns_service_remove(ctx->svr, ctx->svc);
+	pthread_mutex_destroy(&ctx->reactor.mutex);
+	pthread_mutex_destroy(&ctx->stats.mutex);
 
 	free(ctx);
 }
 
 
+/*----------------------------------------------------------------------------*/
+bool raopsr_attach_reactor(struct raopsr_s *ctx, struct raop_reactor_s *reactor) {
+	if (!ctx || !reactor || ctx->reactor.r) return false;
+
+	pthread_mutex_lock(&ctx->reactor.mutex);
+
+	// can't move a connection or a session between thread and reactor
+	if (ctx->reactor.client != -1 || ctx->ht) {
+		pthread_mutex_unlock(&ctx->reactor.mutex);
+		LOG_ERROR("[%p]: can't attach reactor while RTSP is connected", ctx);
+		return false;
+	}
+
+	// RTSP thread does not accept anymore and exits within its select() timeout
+	ctx->reactor.r = reactor;
+	pthread_mutex_unlock(&ctx->reactor.mutex);
+
+	ctx->running = false;
+	pthread_join(ctx->thread, NULL);
+	ctx->running = true;
+
+	if (!raop_reactor_add(reactor, ctx->sock, rtsp_reactor_cb, ctx)) {
+		LOG_ERROR("[%p]: can't attach reactor", ctx);
+		ctx->reactor.r = NULL;
+		pthread_create(&ctx->thread, NULL, &rtsp_thread, ctx);
+		return false;
+	}
+
+	LOG_INFO("[%p]: using reactor %p", ctx, reactor);
+
+	return true;
+}
+
+/*----------------------------------------------------------------------------*/
+void raopsr_set_cache(struct raopsr_s *ctx, struct raop_cache_pool_s *pool) {
+	if (ctx) ctx->cache = pool;
+}
+
+/*----------------------------------------------------------------------------*/
+void raopsr_set_latency(struct raopsr_s *ctx, int ms, bool adaptive) {
+	char *http, *latencies, *p;
+
+	if (!ctx) return;
+
+	// session can't go away and latencies can't be read meanwhile
+	pthread_mutex_lock(&ctx->stats.mutex);
+
+	// keep HTTP part but not adaptive flag, it's set again if needed
+	http = strchr(ctx->latencies, ':');
+	(void)!asprintf(&latencies, "%d%s", ms, http ? http : "");
+	while ((p = strstr(latencies, ":a")) != NULL) memmove(p, p + 2, strlen(p + 2) + 1);
+	free(ctx->latencies);
+	if (adaptive) {
+		(void)!asprintf(&ctx->latencies, "%s:a", latencies);
+		free(latencies);
+	} else ctx->latencies = latencies;
+
+	if (ctx->ht) raopst_set_latency(ctx->ht, ms, adaptive);
+
+	pthread_mutex_unlock(&ctx->stats.mutex);
+}
+
+/*----------------------------------------------------------------------------*/
+int raopsr_get_latency(struct raopsr_s *ctx) {
+	int ms;
+
+	if (!ctx) return -1;
+
+	pthread_mutex_lock(&ctx->stats.mutex);
+	ms = ctx->ht ? raopst_get_latency(ctx->ht) : atoi(ctx->latencies);
+	pthread_mutex_unlock(&ctx->stats.mutex);
+
+	return ms;
+}
+
+/*----------------------------------------------------------------------------*/
+unsigned short raopsr_get_port(struct raopsr_s *ctx) {
+	return ctx ? ctx->port : 0;
+}
+
+/*----------------------------------------------------------------------------*/
+bool raopsr_stats(struct raopsr_s *ctx, raop_stats_t *stats) {
+	raop_stats_t session;
+	uint64_t *values = (uint64_t*) stats, *add = (uint64_t*) &session;
+
+	if (!ctx || !stats) return false;
+
+	pthread_mutex_lock(&ctx->stats.mutex);
+
+	*stats = ctx->stats.totals;
+
+	// levels are the ones of the session in progress, if any
+	if (ctx->ht && raopst_stats(ctx->ht, &session)) {
+		stats->level = session.level;
+		for (size_t i = sizeof(session.level) / sizeof(uint64_t); i < sizeof(session) / sizeof(uint64_t); i++) values[i] += add[i];
+	}
+
+	pthread_mutex_unlock(&ctx->stats.mutex);
+
+	return true;
+}
+
+/*----------------------------------------------------------------------------*/
+static void session_end(raopsr_t *ctx) {
+	uint64_t *totals = (uint64_t*) &ctx->stats.totals, *add;
+	struct raopst_s *ht = ctx->ht;
+	raop_stats_t session;
+
+	pthread_mutex_lock(&ctx->stats.mutex);
+
+	// keep counters of that session
+	if (raopst_stats(ht, &session)) {
+		add = (uint64_t*) &session;
+		for (size_t i = sizeof(session.level) / sizeof(uint64_t); i < sizeof(session) / sizeof(uint64_t); i++) totals[i] += add[i];
+	}
+
+	ctx->ht = NULL;
+
+	pthread_mutex_unlock(&ctx->stats.mutex);
+
+	raopst_end(ht);
+}
+
 /*----------------------------------------------------------------------------*/
 void  raopsr_notify(struct raopsr_s *ctx, raopsr_event_t event, void *param) {
 	struct sockaddr_in addr;
@@ -325,8 +491,14 @@ static void *rtsp_thread(void *arg) {
 			FD_SET(ctx->sock, &rfds);
 
 			if (select(ctx->sock + 1, &rfds, NULL, NULL, &timeout) > 0) {
-				sock = accept(ctx->sock, (struct sockaddr*)&peer, &addrlen);
-				ctx->peer.s_addr = peer.sin_addr.s_addr;
+				// a reactor being attached takes over the listener
+				pthread_mutex_lock(&ctx->reactor.mutex);
+				if (!ctx->reactor.r) {
+					sock = accept(ctx->sock, (struct sockaddr*)&peer, &addrlen);
+					ctx->peer.s_addr = peer.sin_addr.s_addr;
+					ctx->reactor.client = sock;
+				}
+				pthread_mutex_unlock(&ctx->reactor.mutex);
 			}
 
 			if (sock != -1 && ctx->running) {
@@ -346,7 +518,9 @@ static void *rtsp_thread(void *arg) {
 		if (n < 0 || !res) {
 			closesocket(sock);
 			LOG_INFO("RTSP close %u", sock);
-			sock = -1;
+			pthread_mutex_lock(&ctx->reactor.mutex);
+			ctx->reactor.client = sock = -1;
+			pthread_mutex_unlock(&ctx->reactor.mutex);
 		}
 	}
 
@@ -356,6 +530,52 @@ static void *rtsp_thread(void *arg) {
 }
 
 
+/*----------------------------------------------------------------------------*/
+static void rtsp_reactor_cb(void *owner, int fd) {
+	raopsr_t *ctx = (raopsr_t*) owner;
+
+	// one connection at a time, like the thread, so stop listening while it's open
+	if (fd == ctx->sock) {
+		struct sockaddr_in peer;
+		socklen_t addrlen = sizeof(struct sockaddr_in);
+		int sock;
+
+		pthread_mutex_lock(&ctx->reactor.mutex);
+
+		if (ctx->running && (sock = accept(ctx->sock, (struct sockaddr*)&peer, &addrlen)) != -1) {
+			ctx->peer.s_addr = peer.sin_addr.s_addr;
+			raop_reactor_remove(ctx->reactor.r, ctx->sock);
+			// a stalled peer must not hold a pool thread forever
+			raop_reactor_set_timeout(sock, RTSP_STALL_MS);
+			if (raop_reactor_add(ctx->reactor.r, sock, rtsp_reactor_cb, ctx)) {
+				ctx->reactor.client = sock;
+				LOG_INFO("got RTSP connection %u", sock);
+			} else {
+				closesocket(sock);
+				raop_reactor_add(ctx->reactor.r, ctx->sock, rtsp_reactor_cb, ctx);
+			}
+		}
+
+		pthread_mutex_unlock(&ctx->reactor.mutex);
+		return;
+	}
+
+	if (handle_rtsp(ctx, fd)) return;
+
+	pthread_mutex_lock(&ctx->reactor.mutex);
+
+	// unless raopsr_delete has taken it over, close connection and listen again
+	if (ctx->reactor.client == fd) {
+		raop_reactor_remove(ctx->reactor.r, fd);
+		closesocket(fd);
+		LOG_INFO("RTSP close %u", fd);
+		ctx->reactor.client = -1;
+		if (ctx->running) raop_reactor_add(ctx->reactor.r, ctx->sock, rtsp_reactor_cb, ctx);
+	}
+
+	pthread_mutex_unlock(&ctx->reactor.mutex);
+}
+
 /*----------------------------------------------------------------------------*/
 static bool handle_rtsp(raopsr_t *ctx, int sock)
 {
@@ -448,20 +668,29 @@ static bool handle_rtsp(raopsr_t *ctx, int sock)
 		pthread_create(&ctx->search_thread, NULL, &search_remote, ctx);
 
 	} else if (!strcmp(method, "SETUP") && ((buf = kd_lookup(headers, "Transport")) != NULL)) {
-		char *p;
+		char *p, *latencies;
 		raopst_resp_t ht;
 		short unsigned tport = 0, cport = 0;
+		raopst_shared_t shared = { ctx->reactor.r, ctx->cache };
 
 		if ((p = strcasestr(buf, "timing_port")) != NULL) sscanf(p, "%*[^=]=%hu", &tport);
 		if ((p = strcasestr(buf, "control_port")) != NULL) sscanf(p, "%*[^=]=%hu", &cport);
 
-		ht = raopst_init(ctx->host, ctx->peer, ctx->streamer.codec, ctx->streamer.metadata, ctx->drift, true, ctx->latencies,
+		// raopsr_set_latency might replace them anytime
+		pthread_mutex_lock(&ctx->stats.mutex);
+		latencies = strdup(ctx->latencies);
+		pthread_mutex_unlock(&ctx->stats.mutex);
+
+		ht = raopst_init_ex(ctx->host, ctx->peer, ctx->streamer.codec, ctx->streamer.metadata, ctx->drift, true, latencies,
 							ctx->rtsp.aeskey, ctx->rtsp.aesiv, ctx->rtsp.fmtp,
 							cport, tport, ctx, event_cb, http_cb, ctx->ports.base,
-							ctx->ports.range, ctx->http_length);
+							ctx->ports.range, ctx->http_length, &shared);
+		free(latencies);
 
 		ctx->hport = ht.hport;
+		pthread_mutex_lock(&ctx->stats.mutex);
 		ctx->ht = ht.ctx;
+		pthread_mutex_unlock(&ctx->stats.mutex);
 		ctx->flushedArtwork = true;
 
 		if ((cport * tport * ht.cport * ht.tport * ht.aport * ht.hport) != 0 && ht.ctx) {
@@ -479,11 +708,16 @@ static bool handle_rtsp(raopsr_t *ctx, int sock)
 	} else if (strcmp(method, "RECORD") == 0) {
 		unsigned short seqno = 0;
 		unsigned rtptime = 0;
+		int ms;
 		char *p;
 
-		if (atoi(ctx->latencies)) {
+		pthread_mutex_lock(&ctx->stats.mutex);
+		ms = atoi(ctx->latencies);
+		pthread_mutex_unlock(&ctx->stats.mutex);
+
+		if (ms) {
 			char latency[6];
-			snprintf(latency, 6, "%u", (atoi(ctx->latencies) * 44100) / 1000);
+			snprintf(latency, 6, "%u", (ms * 44100) / 1000);
 			kd_add(resp, "Audio-Latency", latency);
 		}
 
@@ -517,9 +751,8 @@ static bool handle_rtsp(raopsr_t *ctx, int sock)
 
 		ctx->raop_cb(ctx->owner, RAOP_STOP);
 		raopsr_metadata_free(&ctx->metadata);
-		raopst_end(ctx->ht);
+		session_end(ctx);
 
-		ctx->ht = NULL;
 		ctx->hport = -1;
 
 		// need to make sure no search is on-going and reclaim pthread memory
@@ -11,6 +11,7 @@
 
 #include "cross_util.h"
 #include "mdnssvc.h"
+#include "raop_hist.h"
 
 typedef struct raopsr_metadata_s {
 	char* artist;
@@ -24,15 +25,72 @@ typedef void (*raopsr_cb_t)(void *owner, raopsr_event_t event, ...);
 typedef void (*raop_http_cb_t)(void *owner, struct key_data_s *headers, struct key_data_s *response);
 
 // set http_length to -3 for chunked-encoding, 0 for no content-length or to a positive value
+// latencies is "<rtp ms>:<http ms>[:f][:a][:r]", ':f' fills missing frames, ':a' adapts rtp hold up to <rtp ms>,
+// ':r' corrects drift by resampling instead of adding/removing frames (ignored when drift is set)
 struct raopsr_s* raopsr_create(struct in_addr host, struct mdnsd *svr, char *name,
 						  char *model, unsigned char mac[6], char *stream_codec, bool stream_metadata,
 						  bool drift, bool flush, char *latencies, void *owner,
 						  raopsr_cb_t raop_cb, raop_http_cb_t http_cb,
 						  unsigned short port_base, unsigned short port_range,
 						  int http_length);
+
 void	raopsr_update(struct raopsr_s *ctx, char *name, char *model);
 void  	raopsr_delete(struct raopsr_s *ctx);
 void	raopsr_notify(struct raopsr_s *ctx, raopsr_event_t event, void *param);
+// RTSP port, to reach the server without going through mDNS
+unsigned short raopsr_get_port(struct raopsr_s *ctx);
+
+/*
+ By default, each server has its own RTSP thread and each session adds RTP and
+ HTTP threads. To run many servers, they can instead share a reactor (see
+ raop_reactor.h) that must outlive them. It should be attached right after
+ raopsr_create as it's refused once an RTSP connection or a session exists
+*/
+struct raop_reactor_s;
+
+bool	raopsr_attach_reactor(struct raopsr_s *ctx, struct raop_reactor_s *reactor);
+
+/*
+ HTTP replay cache of each session is allocated on its own unless a pool (see
+ raop_cache.h) is set, then it is used by sessions created afterwards
+*/
+struct raop_cache_pool_s;
+void	raopsr_set_cache(struct raopsr_s *ctx, struct raop_cache_pool_s *pool);
+
+/*
+ Change RTP hold depth of current session (see latencies) without a flush, at
+ its next sync packet, and for next ones. It's safe from any thread, raop_cb
+ included
+*/
+void	raopsr_set_latency(struct raopsr_s *ctx, int ms, bool adaptive);
+int		raopsr_get_latency(struct raopsr_s *ctx);
+
+/*
+ Statistics of a session (see raopst_stats) or summed over all sessions of a
+ server, counters never go down. Levels are current values, those of session
+ in progress for a server. Frames are RTP ones and histograms are described in
+ raop_hist.h
+*/
+typedef struct {
+	struct {
+		int64_t fill;			// frames in buffer
+		int64_t latency;		// RTP hold depth in ms
+		int64_t gap;			// drift not corrected yet in ms
+		int64_t clients;		// HTTP clients connected
+	} level;
+	struct {
+		uint64_t received, played;
+		uint64_t requested, recovered;	// asked to be re-sent and received in time
+		uint64_t late, dropped;			// received after being played as silence or too old
+		uint64_t silent, filled;		// missing when played, played when buffer was empty
+	} frames;
+	struct { uint64_t added, removed, resampled; } drift;	// frames added/removed, samples resampled in or out
+	struct { uint64_t samples, bytes; } encoder;		// PCM in, encoded out
+	raop_hist_t nack_rtt, decode, http_stall;			// http_stall is sending one frame to all clients
+} raop_stats_t;
+
+// safe from any thread
+bool	raopsr_stats(struct raopsr_s *ctx, raop_stats_t *stats);
 
 void	raopsr_metadata_free(raopsr_metadata_t* data);
 void	raopsr_metadata_copy(raopsr_metadata_t* dst, raopsr_metadata_t *src);
@@ -12,22 +12,35 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <math.h>
 
 #include <pthread.h>
+#include <stdatomic.h>
 #include <openssl/aes.h>
 
 #include "platform.h"
 #include "raop_server.h"
 #include "raop_streamer.h"
+#include "raop_hist_atomic.h"
 #include "encoder.h"
 #include "alac.h"
+#include "raop_reactor.h"
+#include "raop_cache.h"
 
 #include "cross_net.h"
 #include "cross_log.h"
 #include "cross_util.h"
 
+#if LINUX
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#endif
+
+
 #define NTP2MS(ntp) ((((ntp) >> 10) * 1000L) >> 22)
 #define MS2NTP(ms) (((((uint64_t) (ms)) << 22) / 1000) << 10)
+#define NTP2US(ntp) (((ntp) >> 32) * 1000000LL + ((((ntp) & 0xffffffff) * 1000000LL) >> 32))
 #define NTP2TS(ntp, rate) ((((ntp) >> 16) * (rate)) >> 16)
 #define TS2NTP(ts, rate)  (((((uint64_t) (ts)) << 16) / (rate)) << 16)
 #define MS2TS(ms, rate) ((((uint64_t) (ms)) * (rate)) / 1000)
@@ -36,31 +49,95 @@
 #define GAP_THRES	8
 #define GAP_COUNT	20
 
+// NTP exchanges kept for clock estimation (one every 4 sync packets)
+#define NTP_WINDOW		16
+// estimates less accurate than that (us) do not drive drift correction
+#define NTP_ERROR_MAX	2000
+#define NTP_SKEW_MAX	0.0005
+
+// resampler absorbs gap within that time, at a rate never beyond +/- MAX
+#define RESAMPLE_SPAN_MS	10000
+#define RESAMPLE_MAX		0.001
+// above that gap, frames are still added/removed
+#define RESAMPLE_JUMP_MS	50
+
 extern log_level 	raop_loglevel;
 static log_level 	*loglevel = &raop_loglevel;
 
+#define STAT(field) (offsetof(raop_stats_t, field) / sizeof(uint64_t))
+#define STAT_ADD(ctx, field, value) atomic_fetch_add_explicit(&(ctx)->stats[STAT(field)], (value), memory_order_relaxed)
+
 // #define __RTP_STORE
 
 // default buffer size
 #define BUFFER_FRAMES 2048
 #define MAX_PACKET    2048
-#define CACHE_SIZE (2048*1024)
+
+// an ALAC frame is never larger than uncompressed samples and a small header
+#define MAX_PAYLOAD(frames) ((frames) * 4 + 64)
 
 #define RTP_SYNC 0x01
 #define NTP_SYNC 0x02
 
 #define RESEND_TO	150
+#define RESEND_BACKOFF	4		// a missing frame is requested after RESEND_TO, then x2 up to x16
+#define LOSS_SCAN_MS	20		// period of missing frames scan
+
+#define LATENCY_MIN_MS	200		// adaptive hold depth floor
+#define LATENCY_STEP_MS	20		// adaptive hold depth decrease per sync packet
+
+#define MAX_RECV_BATCH	32		// datagrams per recvmmsg call
+
+#define HTTP_ACCEPT_MS	50		// period to check for HTTP connections
+#define HTTP_IDLE_MS	1000	// when only data or request can wake us, just in case
+#define HTTP_STALL_MS	1000	// client not reading or sending for longer is closed
 
 #define ICY_LEN_MAX	 (255*16+1)
+#define HTTP_MAX_IOV 4			// buffers in one HTTP send, not counting chunk framing
+#define HTTP_SLICE	16384		// largest send when catching-up from cache
+#define MAX_HTTP_CLIENTS 4		// simultaneous HTTP clients of one session
 
 enum { DATA, CONTROL, TIMING };
 
 typedef uint16_t seq_t;
-typedef struct audio_buffer_entry {   // decoded audio packets
-	bool ready, missed;
-	uint32_t rtptime, last_resend;
-	int16_t *data;
+
+typedef struct rtp_packet_s {		// received datagram
+	char *data;
+	int len;
+	struct sockaddr_in from;
+} rtp_packet_t;
+
+typedef struct rtp_audio_s {		// audio payload waiting to be queued
+	seq_t seqno;
+	uint32_t rtptime;
+	bool first;
+	char *data;
 	int len;
+} rtp_audio_t;
+
+typedef struct http_client_s {		// each client has its own position in the HTTP cache
+	int sock;
+	bool ready, chunked;
+	size_t pos;
+	struct {
+		bool active;
+		size_t remain;
+		uint32_t version;		// of the last ICY block sent
+	} icy;
+} http_client_t;
+
+/*
+ Received (encrypted) audio packets are in one slab with a cache-aligned slot
+ per frame. What is scanned often is packed apart: states are bitsets and each
+ field is an array, so scans never touch audio data
+*/
+typedef struct audio_buffer_s {
+	uint8_t *slab, *base;			// base is the aligned start in allocated slab
+	size_t stride;
+	uint64_t ready[BUFFER_FRAMES / 64], missed[BUFFER_FRAMES / 64];
+	uint32_t rtptime[BUFFER_FRAMES], last_resend[BUFFER_FRAMES];
+	uint16_t len[BUFFER_FRAMES];
+	uint8_t tries[BUFFER_FRAMES];	// resend requests since frame was found missing
 } abuf_t;
  
 typedef struct raopst_s {
@@ -82,17 +159,52 @@ typedef struct raopst_s {
 	} rtp_sockets[3]; 					 // data, control, timing
 	struct timing_s {
 		bool drift;
-		uint64_t local, remote, rtp_remote;
+		uint64_t rtp_remote;
 		uint32_t count, gap_count;
 		int64_t gap_sum, gap_adjust;
+		/*
+		 remote minus local clock in us, estimated by a regression over
+		 lowest roundtrip exchanges as offset + skew * (local - ref)
+		*/
+		struct {
+			struct {
+				uint64_t local;
+				int64_t offset;
+				uint32_t rtt;
+			} samples[NTP_WINDOW];
+			int count, next;
+			uint64_t ref;
+			int64_t offset, base;
+			double skew;
+			uint32_t error;			// accuracy of offset in us
+			bool based;
+		} est;
 	} timing;
 	struct {
 		uint32_t 	rtp, time;
 		uint8_t  	status;
 		bool	first;
+		int		count;			// sync packets before next timing request
+		bool	ntp_sent;		// timing request could be sent at least once
 	} synchro;
 	int latency;			// rtp hold depth in samples
+	struct {
+		bool enabled;
+		int max;				// hold depth ceiling in samples, 0 is sender's latency
+		atomic_int request;		// ms << 1 | adaptive from raopst_set_latency, -1 if none
+		uint32_t arrival, rtptime;	// last packet in sequence
+		uint32_t jitter;		// interarrival jitter (RFC3550) in ms << 4
+		uint32_t recovery, lag;	// decaying peaks of resend recovery and HTTP lag in ms
+	} adapt;
+	struct {
+		bool enabled;
+		uint64_t step, pos;		// input samples per output sample and position in frame, 32.32 fixed point
+		int16_t last[2];		// last sample of previous frame, interpolation origin
+		double done;			// samples added (or removed) not yet deducted from gap_sum
+		int16_t *out;
+	} resample;
 	int delay;              // http startup silence fill frames
+	atomic_ullong stats[sizeof(raop_stats_t) / sizeof(uint64_t)];
 	uint32_t resent_frames;	// total recovered frames
 	uint32_t silent_frames;	// total silence frames
 	uint32_t silence_count;	// counter for startup silence frames
@@ -100,42 +212,78 @@ typedef struct raopst_s {
 	bool http_fill;         // fill when missing or just wait
 	bool pause;				// set when pause and silent frames must be produced
 	int skip;				// number of frames to skip to keep sync alignement
-	abuf_t audio_buffer[BUFFER_FRAMES];
+	abuf_t audio_buffer;
 	int http_listener;
 	seq_t ab_read, ab_write;
 	pthread_mutex_t ab_mutex;
 	pthread_t http_thread, rtp_thread;
+	struct {
+		struct raop_reactor_s *r;
+		pthread_mutex_t rtp_mutex;	// sockets are not handled in parallel
+		int timer;					// missing frames scan
+	} reactor;
+	struct {
+		int efd, timer, wake;	// epoll of HTTP fds, deadline timerfd and eventfd (Linux)
+		bool waiting, due;		// waiting for frame at ab_read, that will be filled at playtime
+		uint32_t playtime;
+	} http_sched;
+	char *rtp_pool;				// MAX_RECV_BATCH packets of MAX_PACKET
 	struct {
 		bool enabled, active;
 		size_t interval, remain;
 		bool  updated;
+		char block[ICY_LEN_MAX];	// last metadata block, sent by each client at its next interval
+		int len;
+		uint32_t version;
 	} icy;
 	raopsr_metadata_t metadata;
 	char *silence_frame;
+	int16_t *pcm;			// last decoded frame, decoder is only used under ab_mutex
 	alac_file *alac_codec;
 	int first_seqno;
 	enum { RTP_WAIT, RTP_STREAM, RTP_PLAY } state;
-	bool silence, http_ready;
+	bool silence;
+	http_client_t http_clients[MAX_HTTP_CLIENTS];
 	raopst_cb_t event_cb;
 	raop_http_cb_t http_cb;
 	void *owner;
-	uint8_t *http_cache;
-	size_t http_count;
+	struct raop_cache_s *http_cache;
 	int http_length;
 	bool close_socket;
 } raopst_t;
 
 #define BUFIDX(seqno) ((seq_t)(seqno) % BUFFER_FRAMES)
+#define BUFDATA(ab, seqno) ((ab)->base + BUFIDX(seqno) * (ab)->stride)
 static void 	buffer_alloc(abuf_t *audio_buffer, int size);
 static void 	buffer_release(abuf_t *audio_buffer);
 static void 	buffer_reset(abuf_t *audio_buffer);
 
+static void 	resample_adjust(raopst_t *ctx);
+static int16_t*	resample_frame(raopst_t *ctx, int16_t *pcm, size_t *frames);
+
 static bool 	rtp_request_resend(raopst_t *ctx, seq_t first, seq_t last);
+static void 	rtp_scan_losses(raopst_t *ctx);
+static void 	rtp_timer_cb(void *owner, int fd);
 static bool 	rtp_request_timing(raopst_t *ctx);
+static uint64_t	gettime_local_us(void);
+static void 	ntp_estimate(raopst_t *ctx, uint64_t sent, int64_t remote_rx, int64_t remote_tx, uint64_t received);
+static uint32_t	ntp_local_ms(raopst_t *ctx, uint64_t ntp);
 static void*	rtp_thread_func(void *arg);
+static void 	rtp_reactor_cb(void *owner, int fd);
+static void 	rtp_drain(raopst_t *ctx, int idx);
+static bool 	rtp_handle_packet(raopst_t *ctx, char *packet, ssize_t plen, rtp_audio_t *audio);
 
 static void*	http_thread_func(void *arg);
-static bool 	handle_http(raopst_t *ctx, int sock);
+static void 	http_reactor_cb(void *owner, int fd);
+static bool 	http_sched_init(raopst_t *ctx);
+static void 	http_sched_free(raopst_t *ctx);
+static void 	http_sched_wake(raopst_t *ctx);
+static void 	http_sched_run(raopst_t *ctx);
+static void 	http_sched_add(raopst_t *ctx, int fd);
+static void 	http_accept(raopst_t *ctx);
+static uint32_t	http_serve(raopst_t *ctx, uint32_t wait_us);
+static bool 	handle_http(raopst_t *ctx, http_client_t *client);
+static ssize_t	send_iov(bool chunked, int sock, struct iovec *iov, int count);
 
 static int	  	seq_order(seq_t a, seq_t b);
 
@@ -180,11 +328,26 @@ raopst_resp_t raopst_init(struct in_addr host, struct in_addr peer, char *codec,
 								raopst_cb_t event_cb, raop_http_cb_t http_cb,
 								unsigned short port_base, unsigned short port_range,
 								int http_length) {
+	return raopst_init_ex(host, peer, codec, metadata, drift, range, latencies, aeskey, aesiv, fmtpstr,
+						  pCtrlPort, pTimingPort, owner, event_cb, http_cb, port_base, port_range,
+						  http_length, NULL);
+}
+
+/*---------------------------------------------------------------------------*/
+raopst_resp_t raopst_init_ex(struct in_addr host, struct in_addr peer, char *codec, bool metadata,
+								bool drift, bool range, char *latencies,
+								char *aeskey, char *aesiv, char *fmtpstr,
+								short unsigned pCtrlPort, short unsigned pTimingPort,
+								void *owner,
+								raopst_cb_t event_cb, raop_http_cb_t http_cb,
+								unsigned short port_base, unsigned short port_range,
+								int http_length, raopst_shared_t *shared) {
 	char *arg, *p;
 	int fmtp[12];
 	bool rc = true;
 	raopst_t *ctx = calloc(1, sizeof(raopst_t));
 	raopst_resp_t resp = { 0, 0, 0, 0, NULL };
+	struct raop_reactor_s *reactor = shared ? shared->reactor : NULL;
 	struct {
 		unsigned short count, offset;
 	} port = { 0 };
@@ -193,13 +356,18 @@ raopst_resp_t raopst_init(struct in_addr host, struct in_addr peer, char *codec,
 
 	if (!ctx) return resp;
 	
-	ctx->http_cache = malloc(CACHE_SIZE);
+	ctx->http_cache = raop_cache_create(shared ? shared->cache : NULL);
 	ctx->http_length = http_length;
 	ctx->host = host;
 	ctx->peer = peer;
 	ctx->rtp_host.sin_family = AF_INET;
 	ctx->rtp_host.sin_addr.s_addr = INADDR_ANY;
 	pthread_mutex_init(&ctx->ab_mutex, 0);
+	pthread_mutex_init(&ctx->reactor.rtp_mutex, 0);
+	ctx->http_sched.efd = ctx->http_sched.timer = ctx->http_sched.wake = -1;
+	ctx->reactor.timer = -1;
+	for (int i = 0; i < MAX_HTTP_CLIENTS; i++) ctx->http_clients[i].sock = -1;
+	ctx->rtp_pool = malloc(MAX_RECV_BATCH * MAX_PACKET);
 	ctx->first_seqno = -1;
 
 	// create the encoder
@@ -209,6 +377,13 @@ raopst_resp_t raopst_init(struct in_addr host, struct in_addr peer, char *codec,
 	ctx->latency = atoi(latencies);
 	ctx->latency = (ctx->latency * 44100) / 1000;
 	if (strstr(latencies, ":f")) ctx->http_fill = true;
+	// adaptive mode starts from the largest possible depth
+	if (strstr(latencies, ":a")) ctx->adapt.enabled = true;
+	// smooth drift correction makes no sense if there is none
+	if (strstr(latencies, ":r") && !drift) ctx->resample.enabled = true;
+	ctx->resample.step = 1ULL << 32;
+	ctx->adapt.max = ctx->latency;
+	atomic_init(&ctx->adapt.request, -1);
 	ctx->event_cb = event_cb;
 	ctx->http_cb = http_cb;
 	ctx->owner = owner;
@@ -238,6 +413,8 @@ raopst_resp_t raopst_init(struct in_addr host, struct in_addr peer, char *codec,
 
 	ctx->frame_size = fmtp[1];
 	ctx->silence_frame = (char*) calloc(ctx->frame_size, 4);
+	ctx->pcm = malloc(ctx->frame_size * 4);
+	if (ctx->resample.enabled) ctx->resample.out = malloc((ctx->frame_size + ctx->frame_size / 256 + 2) * 4);
 	if ((p = strchr(latencies, ':')) != NULL) {
 		ctx->delay = atoi(p + 1);
 		ctx->delay = (ctx->delay * 44100) / (ctx->frame_size * 1000);
@@ -247,7 +424,8 @@ raopst_resp_t raopst_init(struct in_addr host, struct in_addr peer, char *codec,
 	ctx->alac_codec = alac_init(fmtp);
 	rc &= ctx->alac_codec != NULL;
 
-	buffer_alloc(ctx->audio_buffer, ctx->frame_size*4);
+	// packets are stored as received, with room for ALAC reader
+	buffer_alloc(&ctx->audio_buffer, MAX_PAYLOAD(ctx->frame_size) + ALAC_INPUT_PADDING);
 
 	for (int i = 0; rc && i < 3; i++) {
 		do {
@@ -269,7 +447,10 @@ raopst_resp_t raopst_init(struct in_addr host, struct in_addr peer, char *codec,
 	int i = 128*1024;
 	setsockopt(ctx->http_listener, SOL_SOCKET, SO_SNDBUF, (void*) &i, sizeof(i));
 	rc &= ctx->http_listener > 0;
-	rc &= listen(ctx->http_listener, 1) == 0;
+	rc &= listen(ctx->http_listener, MAX_HTTP_CLIENTS) == 0;
+
+	// without the event set, HTTP falls back to polling (not an error unless a reactor is used)
+	if (rc && !http_sched_init(ctx) && reactor) rc = false;
 
 	resp.cport = ctx->rtp_sockets[CONTROL].lport;
 	resp.tport = ctx->rtp_sockets[TIMING].lport;
@@ -277,11 +458,25 @@ raopst_resp_t raopst_init(struct in_addr host, struct in_addr peer, char *codec,
 
 	LOG_INFO("[%p]: HTTP listening port %hu", ctx, resp.hport);
 
-	if (rc) {
+	if (rc && reactor) {
+		ctx->running = true;
+		ctx->reactor.r = reactor;
+
+		// send synchro requests 3 times
+		for (int i = 0; i < 3; i++) ctx->synchro.ntp_sent = rtp_request_timing(ctx);
+
+		for (int i = 0; rc && i < 3; i++) rc &= raop_reactor_add(reactor, ctx->rtp_sockets[i].sock, rtp_reactor_cb, ctx);
+		rc &= (ctx->reactor.timer = raop_reactor_add_timer(reactor, LOSS_SCAN_MS, rtp_timer_cb, ctx)) != -1;
+
+		// all HTTP fds are behind the event set, so callback is never run in parallel
+		rc &= raop_reactor_add(reactor, ctx->http_sched.efd, http_reactor_cb, ctx);
+	} else if (rc) {
 		ctx->running = true;
 		pthread_create(&ctx->rtp_thread, NULL, rtp_thread_func, (void *) ctx);
 		pthread_create(&ctx->http_thread, NULL, http_thread_func, (void *) ctx);
-	} else {
+	}
+
+	if (!rc) {
 		raopst_end(ctx);
 		ctx = NULL;
 	}
@@ -301,26 +496,137 @@ void raopst_metadata(struct raopst_s *ctx, raopsr_metadata_t *metadata) {
 	pthread_mutex_unlock(&ctx->ab_mutex);
 }
 
+/*---------------------------------------------------------------------------*/
+void raopst_set_latency(struct raopst_s *ctx, int ms, bool adaptive) {
+	// caller might hold ab_mutex (event_cb) so it's applied at next sync packet
+	atomic_store(&ctx->adapt.request, ms << 1 | adaptive);
+	LOG_INFO("[%p]: latency set to %d ms (adaptive: %d)", ctx, ms, adaptive);
+}
+
+/*---------------------------------------------------------------------------*/
+int raopst_get_latency(struct raopst_s *ctx) {
+	return (ctx->latency * 1000) / 44100;
+}
+
+/*---------------------------------------------------------------------------*/
+bool raopst_stats(struct raopst_s *ctx, raop_stats_t *stats) {
+	uint64_t *values = (uint64_t*) stats;
+
+	if (!ctx || !stats) return false;
+
+	for (size_t i = 0; i < sizeof(ctx->stats) / sizeof(*ctx->stats); i++) {
+		values[i] = atomic_load_explicit(ctx->stats + i, memory_order_relaxed);
+	}
+
+	// levels are read as they are, a torn value does not matter
+	stats->level.fill = (short) (ctx->ab_write - ctx->ab_read + 1);
+	stats->level.latency = (ctx->latency * 1000) / 44100;
+	stats->level.gap = ctx->timing.gap_sum;
+	stats->level.clients = 0;
+	for (int i = 0; i < MAX_HTTP_CLIENTS; i++) if (ctx->http_clients[i].sock != -1) stats->level.clients++;
+
+	return true;
+}
+
+/*---------------------------------------------------------------------------*/
+static void adapt_latency(raopst_t *ctx, uint32_t sender) {
+	int max = ctx->adapt.max ? ctx->adapt.max : (int) sender;
+	int target = LATENCY_MIN_MS + (ctx->adapt.jitter >> 4) * 4 + ctx->adapt.recovery + ctx->adapt.lag;
+
+	target = min((target * 44100) / 1000, max);
+
+	// grow at once to protect against underruns, shrink slowly
+	if (target > ctx->latency) ctx->latency = target;
+	else ctx->latency -= min(ctx->latency - target, (LATENCY_STEP_MS * 44100) / 1000);
+
+	// peaks fade away over a few seconds
+	ctx->adapt.recovery -= ctx->adapt.recovery / 8;
+	ctx->adapt.lag -= ctx->adapt.lag / 8;
+
+	LOG_DEBUG("[%p]: latency %d ms (target:%d jitter:%u recovery:%u lag:%u)", ctx, (ctx->latency * 1000) / 44100,
+			  (target * 1000) / 44100, ctx->adapt.jitter >> 4, ctx->adapt.recovery, ctx->adapt.lag);
+}
+
+/*---------------------------------------------------------------------------*/
+// deduct what has been caught up from the gap and set rate to absorb what remains
+static void resample_adjust(raopst_t *ctx) {
+	int64_t ms = ctx->resample.done / 44.1;
+	double ratio;
+
+	ctx->resample.done -= ms * 44.1;
+	ctx->timing.gap_sum -= ms;
+	ctx->timing.gap_adjust -= ms;
+
+	// positive gap means we run too fast so output must have more samples than input
+	ratio = (double) ctx->timing.gap_sum / RESAMPLE_SPAN_MS;
+	ratio = max(min(ratio, RESAMPLE_MAX), -RESAMPLE_MAX);
+	ctx->resample.step = (double) (1ULL << 32) / (1 + ratio);
+
+	LOG_DEBUG("[%p]: resampling at %+d ppm (gap:%" PRId64 ")", ctx, (int) (ratio * 1000000), ctx->timing.gap_sum);
+}
+
+/*---------------------------------------------------------------------------*/
+// linear interpolation, position 0 being last sample of previous frame
+static int16_t *resample_frame(raopst_t *ctx, int16_t *pcm, size_t *frames) {
+	uint64_t pos = ctx->resample.pos, end = (uint64_t) *frames << 32;
+	int16_t *out = ctx->resample.out;
+	size_t n = 0;
+
+	if (!*frames) return pcm;
+
+	for (; pos < end; pos += ctx->resample.step, n++) {
+		size_t i = pos >> 32;
+		int32_t frac = (pos >> 17) & 0x7fff;
+		int16_t *a = i ? pcm + (i - 1) * 2 : ctx->resample.last, *b = pcm + i * 2;
+
+		out[n * 2] = a[0] + (((b[0] - a[0]) * frac) >> 15);
+		out[n * 2 + 1] = a[1] + (((b[1] - a[1]) * frac) >> 15);
+	}
+
+	ctx->resample.pos = pos - end;
+	ctx->resample.last[0] = pcm[(*frames - 1) * 2];
+	ctx->resample.last[1] = pcm[(*frames - 1) * 2 + 1];
+	ctx->resample.done += (double) n - *frames;
+	if (n != *frames) STAT_ADD(ctx, drift.resampled, n > *frames ? n - *frames : *frames - n);
+
+	*frames = n;
+	return out;
+}
+
 /*---------------------------------------------------------------------------*/
 void raopst_end(raopst_t *ctx) {
 	if (!ctx) return;
 
-	if (ctx->running) {
+	if (ctx->reactor.r) {
+		// once removed, callbacks are not running and will not be called again
+		ctx->running = false;
+		for (int i = 0; i < 3; i++) raop_reactor_remove(ctx->reactor.r, ctx->rtp_sockets[i].sock);
+		raop_reactor_remove(ctx->reactor.r, ctx->reactor.timer);
+		raop_reactor_remove(ctx->reactor.r, ctx->http_sched.efd);
+	} else if (ctx->running) {
 		ctx->running = false;
+		http_sched_wake(ctx);
 		pthread_join(ctx->rtp_thread, NULL);
 		pthread_join(ctx->http_thread, NULL);
 	}
 
+	http_sched_free(ctx);
+
 	shutdown_socket(ctx->http_listener);
+	for (int i = 0; i < MAX_HTTP_CLIENTS; i++) if (ctx->http_clients[i].sock != -1) shutdown_socket(ctx->http_clients[i].sock);
 	for (int i = 0; i < 3; i++) if (ctx->rtp_sockets[i].sock > 0) closesocket(ctx->rtp_sockets[i].sock);
 
 	delete_alac(ctx->alac_codec);
 	encoder_delete(ctx->encoder);
 
 	pthread_mutex_destroy(&ctx->ab_mutex);
-	buffer_release(ctx->audio_buffer);
+	pthread_mutex_destroy(&ctx->reactor.rtp_mutex);
+	buffer_release(&ctx->audio_buffer);
+	free(ctx->rtp_pool);
 	free(ctx->silence_frame);
-	free(ctx->http_cache);
+	free(ctx->pcm);
+	free(ctx->resample.out);
+	raop_cache_delete(ctx->http_cache);
 	raopsr_metadata_free(&ctx->metadata);
 	free(ctx);
 
@@ -341,18 +647,21 @@ bool raopst_flush(raopst_t *ctx, unsigned short seqno, unsigned int rtptime, boo
 	if (silence) {
 		ctx->pause = true;
 	} else if (ctx->state == RTP_PLAY) {
-		buffer_reset(ctx->audio_buffer);
+		buffer_reset(&ctx->audio_buffer);
 		ctx->state = RTP_WAIT;
 		ctx->synchro.first = false;
-		ctx->http_ready = false;
 		ctx->close_socket = true;
-		ctx->http_count = 0;
+		raop_cache_reset(ctx->http_cache);
+		ctx->http_sched.waiting = false;
 		ctx->ab_read = ctx->ab_write + 1;
 		encoder_close(ctx->encoder);
 	} else {
 		flushed = false;
 	}
 
+	// HTTP has to close or to start sending silence now
+	if (flushed) http_sched_wake(ctx);
+
 	LOG_INFO("[%p]: FLUSH packets below %hu - %u", ctx, seqno, rtptime);
 
 	if (!exit_locked || !flushed) pthread_mutex_unlock(&ctx->ab_mutex);
@@ -373,20 +682,32 @@ void raopst_record(raopst_t *ctx, unsigned short seqno, unsigned rtptime) {
 
 /*---------------------------------------------------------------------------*/
 static void buffer_alloc(abuf_t *audio_buffer, int size) {
-	for (int i = 0; i < BUFFER_FRAMES; i++) {
-		audio_buffer[i].data = malloc(size);
-		audio_buffer[i].ready = 0;
-	}
+	// one allocation for all frames, each starting on a cache line
+	audio_buffer->stride = (size + 63) & ~63;
+	audio_buffer->slab = malloc(audio_buffer->stride * BUFFER_FRAMES + 63);
+	audio_buffer->base = (uint8_t*) (((uintptr_t) audio_buffer->slab + 63) & ~(uintptr_t) 63);
+	buffer_reset(audio_buffer);
 }
 
 /*---------------------------------------------------------------------------*/
 static void buffer_release(abuf_t *audio_buffer) {
-	for (int i = 0; i < BUFFER_FRAMES; i++) free(audio_buffer[i].data);
+	free(audio_buffer->slab);
 }
 
 /*---------------------------------------------------------------------------*/
 static void buffer_reset(abuf_t *audio_buffer) {
-	for (int i = 0; i < BUFFER_FRAMES; i++) audio_buffer[i].ready = 0;
+	memset(audio_buffer->ready, 0, sizeof(audio_buffer->ready));
+}
+
+/*---------------------------------------------------------------------------*/
+static inline bool buffer_bit(uint64_t *set, seq_t seqno) {
+	return (set[BUFIDX(seqno) / 64] >> (BUFIDX(seqno) % 64)) & 1;
+}
+
+/*---------------------------------------------------------------------------*/
+static inline void buffer_set(uint64_t *set, seq_t seqno, bool value) {
+	if (value) set[BUFIDX(seqno) / 64] |= 1ULL << (BUFIDX(seqno) % 64);
+	else set[BUFIDX(seqno) / 64] &= ~(1ULL << (BUFIDX(seqno) % 64));
 }
 
 /*---------------------------------------------------------------------------*/
@@ -398,8 +719,8 @@ static int seq_order(seq_t a, seq_t b) {
 }
 
 /*---------------------------------------------------------------------------*/
-static void alac_decode(raopst_t *ctx, int16_t *dest, char *buf, int len, int *outsize) {
-	unsigned char packet[MAX_PACKET];
+static void alac_decode(raopst_t *ctx, int16_t *dest, uint8_t *buf, int len, int *outsize) {
+	unsigned char packet[MAX_PACKET + ALAC_INPUT_PADDING];
 	unsigned char iv[16];
 	int aeslen;
 	assert(len<=MAX_PACKET);
@@ -407,15 +728,14 @@ static void alac_decode(raopst_t *ctx, int16_t *dest, char *buf, int len, int *o
 	if (ctx->decrypt) {
 		aeslen = len & ~0xf;
 		memcpy(iv, ctx->aesiv, sizeof(iv));
-		AES_cbc_encrypt((unsigned char*)buf, packet, aeslen, &ctx->aes, iv, AES_DECRYPT);
+		AES_cbc_encrypt(buf, packet, aeslen, &ctx->aes, iv, AES_DECRYPT);
 		memcpy(packet+aeslen, buf+aeslen, len-aeslen);
 		decode_frame(ctx->alac_codec, packet, dest, outsize);
-	} else decode_frame(ctx->alac_codec, (unsigned char*) buf, dest, outsize);
+	} else decode_frame(ctx->alac_codec, buf, dest, outsize);
 }
 
 /*---------------------------------------------------------------------------*/
-static void buffer_put_packet(raopst_t* ctx, seq_t seqno, unsigned rtptime, bool first, char* data, int len) {
-	pthread_mutex_lock(&ctx->ab_mutex);
+static void _buffer_put_packet(raopst_t* ctx, seq_t seqno, unsigned rtptime, bool first, char* data, int len) {
 
 	/* if we have received a RECORD with a seqno, then this is the first allowed rtp sequence number 
 	 * and we are in RTP_WAIT state. If seqno was 0, then we are waiting for a flush that will tell 
@@ -426,10 +746,7 @@ static void buffer_put_packet(raopst_t* ctx, seq_t seqno, unsigned rtptime, bool
 	 * a catch that recent iOS send silence frames just after flush when paused */
 
 	// if we have a pending first seqno and we are below, always ignore it
-	if (ctx->first_seqno != -1 && seq_order(seqno, ctx->first_seqno)) {
-		pthread_mutex_unlock(&ctx->ab_mutex);
-		return;
-	}
+	if (ctx->first_seqno != -1 && seq_order(seqno, ctx->first_seqno)) return;
 
 	if (ctx->state == RTP_WAIT) {
 		ctx->ab_write = seqno - 1;
@@ -438,11 +755,14 @@ static void buffer_put_packet(raopst_t* ctx, seq_t seqno, unsigned rtptime, bool
 		ctx->silence = true;
 		ctx->synchro.first = false;
 		ctx->resent_frames = ctx->silent_frames = 0;
-		ctx->http_count = 0;
+		ctx->adapt.arrival = 0;
+		raop_cache_reset(ctx->http_cache);
 		if (ctx->first_seqno != -1) {
 			ctx->state = RTP_PLAY;
 			ctx->first_seqno = -1;
 			encoder_open(ctx->encoder);
+			// HTTP was not waiting for frames until now
+			http_sched_wake(ctx);
 			LOG_INFO("[%p]: 1st accepted packet:%d, now playing", ctx, seqno);
 		} else {
 			ctx->state = RTP_STREAM;
@@ -451,13 +771,14 @@ static void buffer_put_packet(raopst_t* ctx, seq_t seqno, unsigned rtptime, bool
 	} else if (ctx->state == RTP_STREAM && ctx->first_seqno != -1 && seq_order(ctx->first_seqno, seqno + 1)) {
 		// now we're talking, but first discard all packets with a seqno below first_seqno AND not ready
 		while (seq_order(ctx->ab_read, ctx->first_seqno) ||
-			!ctx->audio_buffer[BUFIDX(ctx->ab_read)].ready) {
-			ctx->audio_buffer[BUFIDX(ctx->ab_read)].ready = false;
+			!buffer_bit(ctx->audio_buffer.ready, ctx->ab_read)) {
+			buffer_set(ctx->audio_buffer.ready, ctx->ab_read, false);
 			ctx->ab_read++;
 		}
 		ctx->state = RTP_PLAY;
 		ctx->first_seqno = -1;
 		encoder_open(ctx->encoder);
+		http_sched_wake(ctx);
 		LOG_INFO("[%p]: done waiting for FLUSH with packet:%d, now playing starting:%hu", ctx, seqno, ctx->ab_read);
 	}
 
@@ -475,11 +796,10 @@ static void buffer_put_packet(raopst_t* ctx, seq_t seqno, unsigned rtptime, bool
 	double test_ratio = test_packet.count ? (double)test_packet.failed / test_packet.count : 0.0;
 	if (test_ratio > TEST_PACKET * 1.025) test_packet.active = false;
 	else if (test_ratio < TEST_PACKET * 0.975) test_packet.active = true;
-	if (test_packet.active && ctx->http_count) {
+	if (test_packet.active && raop_cache_count(ctx->http_cache)) {
 		if ((rand() % (10 - test_packet.last)) && test_packet.last < 10) {
 			test_packet.last++;
 			test_packet.failed++;
-			pthread_mutex_unlock(&ctx->ab_mutex);
 			return;
 		}
 		test_packet.last = 0;
@@ -490,7 +810,17 @@ static void buffer_put_packet(raopst_t* ctx, seq_t seqno, unsigned rtptime, bool
 	// release as soon as one recent frame is received
 	if (ctx->pause && seq_order(ctx->first_seqno, seqno)) ctx->pause = false;
 
-	abuf_t* abuf = ctx->audio_buffer + BUFIDX(seqno);
+	abuf_t* abuf = &ctx->audio_buffer;
+	bool store = true;
+	uint32_t now = gettime_ms();
+
+	// interarrival jitter of packets in sequence, as in RFC3550
+	if (ctx->state == RTP_PLAY && seq_order(ctx->ab_write, seqno)) {
+		int32_t d = (now - ctx->adapt.arrival) - ((int32_t) (rtptime - ctx->adapt.rtptime) * 1000) / 44100;
+		if (ctx->adapt.arrival) ctx->adapt.jitter += abs(d) - ((ctx->adapt.jitter + 8) >> 4);
+		ctx->adapt.arrival = now;
+		ctx->adapt.rtptime = rtptime;
+	}
 
 	if (seqno == (uint16_t) (ctx->ab_write + 1)) {
 		// expected packet
@@ -506,45 +836,70 @@ static void buffer_put_packet(raopst_t* ctx, seq_t seqno, unsigned rtptime, bool
 		if (ctx->delay && seq_order(ctx->delay, seqno - ctx->ab_read)) {
 			// if ab_read is lagging more than http latency, advance it
 			LOG_WARN("[%p] on hold for too long %hu (%hu)", ctx, ctx->ab_read, seqno - ctx->ab_read + 1);
-			for (seq_t i = ctx->ab_read; seq_order(i, seqno - ctx->delay + 1); i++) ctx->audio_buffer[BUFIDX(i)].ready = false;
+			for (seq_t i = ctx->ab_read; seq_order(i, seqno - ctx->delay + 1); i++) buffer_set(abuf->ready, i, false);
 			ctx->ab_read = seqno - ctx->delay + 1;		
 		}
 		// don't bother requesting for resend if we are not playing yet (packet might be old garbage)
 		if (ctx->state == RTP_PLAY && rtp_request_resend(ctx, ctx->ab_write + 1, seqno-1)) {
-			uint32_t now = gettime_ms();
 			for (seq_t i = ctx->ab_write + 1; seq_order(i, seqno); i++) {
-				ctx->audio_buffer[BUFIDX(i)].rtptime = rtptime - (seqno-i)*ctx->frame_size;
-				ctx->audio_buffer[BUFIDX(i)].last_resend = now;
+				abuf->rtptime[BUFIDX(i)] = rtptime - (seqno-i)*ctx->frame_size;
+				abuf->last_resend[BUFIDX(i)] = now;
+				abuf->tries[BUFIDX(i)] = 0;
 			}
 		}
 		LOG_DEBUG("[%p]: packet newer seqno:%hu rtptime:%u (W:%hu R:%hu)", ctx, seqno, rtptime, ctx->ab_write, ctx->ab_read);
 		ctx->ab_write = seqno;
 	} else if (seq_order(ctx->ab_read, seqno + 1)) {
 		// recovered packet, not yet sent
+		uint32_t recovery = now - abuf->last_resend[BUFIDX(seqno)];
+		// a stale resend time can't be within hold depth
+		if (!buffer_bit(abuf->ready, seqno) && recovery <= (ctx->latency * 1000) / 44100) {
+			ctx->adapt.recovery = max(ctx->adapt.recovery, recovery);
+			STAT_ADD(ctx, frames.recovered, 1);
+			raop_hist_add(ctx->stats + STAT(nack_rtt), recovery * 1000);
+		}
 		LOG_DEBUG("[%p]: packet recovered seqno:%hu rtptime:%u (W:%hu R:%hu)", ctx, seqno, rtptime, ctx->ab_write, ctx->ab_read);
 	} else {
-		if (abuf->missed) LOG_INFO("[%p]: packet too late seqno:%hu rtptime:%u (W:%hu R:%hu)", ctx, seqno, rtptime, ctx->ab_write, ctx->ab_read);
-		abuf = NULL;
+		if (buffer_bit(abuf->missed, seqno)) {
+			LOG_INFO("[%p]: packet too late seqno:%hu rtptime:%u (W:%hu R:%hu)", ctx, seqno, rtptime, ctx->ab_write, ctx->ab_read);
+			STAT_ADD(ctx, frames.late, 1);
+		} else STAT_ADD(ctx, frames.dropped, 1);
+		store = false;
 	}
 
+	STAT_ADD(ctx, frames.received, 1);
+
 	if (!(ctx->in_frames++ & 0xfff) || (!(ctx->in_frames & 0x3f) && ctx->ab_write - ctx->ab_read > 24 && ctx->state == RTP_PLAY)) {
 		LOG_INFO("[%p]: fill [level:%hu] [W:%hu R:%hu]", ctx, ctx->ab_write - ctx->ab_read + 1, ctx->ab_write, ctx->ab_read);
 	}
 
-	if (abuf) {
-		alac_decode(ctx, abuf->data, data, len, &abuf->len);
-		abuf->ready = true;
-		abuf->missed = false;
+	if (store && len > MAX_PAYLOAD(ctx->frame_size)) {
+		LOG_WARN("[%p]: packet too large seqno:%hu len:%d", ctx, seqno, len);
+		store = false;
+	}
+
+	if (store) {
+		bool silence = false;
+
+		// just store it, decoding is done when frame is played
+		memcpy(BUFDATA(abuf, seqno), data, len);
+		abuf->len[BUFIDX(seqno)] = len;
+		buffer_set(abuf->ready, seqno, true);
+		buffer_set(abuf->missed, seqno, false);
 		// this is the local rtptime when this frame is expected to play
-		abuf->rtptime = rtptime;
+		abuf->rtptime[BUFIDX(seqno)] = rtptime;
 #ifdef __RTP_STORE
 		fwrite(data, len, 1, ctx->rtpIN);
-		fwrite(abuf->data, abuf->len, 1, ctx->rtpOUT);
 #endif
-		bool silence = ctx->silence ? !memcmp(abuf->data, ctx->silence_frame, abuf->len) : false;
+		// until real audio starts, need to look into frames to find silence
+		if (ctx->silence) {
+			int size;
+			alac_decode(ctx, ctx->pcm, BUFDATA(abuf, seqno), len, &size);
+			silence = size <= ctx->frame_size * 4 && !memcmp(ctx->pcm, ctx->silence_frame, size);
+		}
 
 		// just discard all silences frames at the beginning (might be an iOS flush + silence)
-		if (silence && ctx->ab_write - ctx->ab_read > 1) ctx->audio_buffer[BUFIDX(ctx->ab_read++)].ready = false;
+		if (silence && ctx->ab_write - ctx->ab_read > 1) buffer_set(abuf->ready, ctx->ab_read++, false);
 
 		if (ctx->state == RTP_PLAY && ctx->silence && !silence) {
 			ctx->event_cb(ctx->owner, RAOP_STREAMER_PLAY);
@@ -553,228 +908,429 @@ static void buffer_put_packet(raopst_t* ctx, seq_t seqno, unsigned rtptime, bool
 			if (ctx->metadata.title) ctx->icy.updated = true;
 		}
 	}
+}
+
+/*---------------------------------------------------------------------------*/
+static void buffer_put_packets(raopst_t* ctx, rtp_audio_t *audio, int count) {
+	pthread_mutex_lock(&ctx->ab_mutex);
+
+	for (int i = 0; i < count; i++) {
+		_buffer_put_packet(ctx, audio[i].seqno, audio[i].rtptime, audio[i].first, audio[i].data, audio[i].len);
+	}
+
+	// HTTP can send now what it was waiting for
+	if (ctx->http_sched.waiting && buffer_bit(ctx->audio_buffer.ready, ctx->ab_read)) {
+		ctx->http_sched.waiting = false;
+		http_sched_wake(ctx);
+	}
 
 	pthread_mutex_unlock(&ctx->ab_mutex);
 }
 
+/*---------------------------------------------------------------------------*/
+static int rtp_receive(int sock, rtp_packet_t *packets, int count) {
+	socklen_t addrlen = sizeof(packets[0].from);
+
+#if LINUX
+	struct mmsghdr msgs[MAX_RECV_BATCH];
+	struct iovec iov[MAX_RECV_BATCH];
+	int n;
+
+	count = min(count, MAX_RECV_BATCH);
+	memset(msgs, 0, count * sizeof(struct mmsghdr));
+
+	for (int i = 0; i < count; i++) {
+		iov[i].iov_base = packets[i].data;
+		iov[i].iov_len = MAX_PACKET;
+		msgs[i].msg_hdr.msg_name = &packets[i].from;
+		msgs[i].msg_hdr.msg_namelen = sizeof(packets[i].from);
+		msgs[i].msg_hdr.msg_iov = iov + i;
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	// take whatever is queued, without waiting for more
+	n = recvmmsg(sock, msgs, count, MSG_DONTWAIT, NULL);
+
+	for (int i = 0; i < n; i++) packets[i].len = msgs[i].msg_len;
+
+	// old kernel, fallback to a single read
+	if (n >= 0 || errno != ENOSYS) return max(n, 0);
+#endif
+
+	// socket is readable, so that will not block
+	packets[0].len = recvfrom(sock, packets[0].data, MAX_PACKET, 0, (struct sockaddr*) &packets[0].from, &addrlen);
+	return packets[0].len < 0 ? 0 : 1;
+}
+
+/*---------------------------------------------------------------------------*/
+static void rtp_drain(raopst_t *ctx, int idx) {
+	rtp_packet_t packets[MAX_RECV_BATCH];
+	rtp_audio_t audio[MAX_RECV_BATCH];
+	int i, n = MAX_RECV_BATCH;
+
+	for (i = 0; i < MAX_RECV_BATCH; i++) packets[i].data = ctx->rtp_pool + i * MAX_PACKET;
+
+	// audio packets are queued by batches
+	while (n == MAX_RECV_BATCH && (n = rtp_receive(ctx->rtp_sockets[idx].sock, packets, MAX_RECV_BATCH)) > 0) {
+		int queued = 0;
+
+		for (i = 0; i < n; i++) {
+			// sender's address is needed for our requests (ports are from RTSP)
+			if (packets[i].from.sin_addr.s_addr != ctx->rtp_host.sin_addr.s_addr) {
+				pthread_mutex_lock(&ctx->ab_mutex);
+				ctx->rtp_host.sin_addr = packets[i].from.sin_addr;
+				pthread_mutex_unlock(&ctx->ab_mutex);
+			}
+
+			if (rtp_handle_packet(ctx, packets[i].data, packets[i].len, audio + queued)) queued++;
+		}
+
+		if (queued) buffer_put_packets(ctx, audio, queued);
+	}
+
+	if (!ctx->synchro.ntp_sent) {
+		LOG_WARN("[%p]: NTP request not sent yet", ctx);
+		ctx->synchro.ntp_sent = rtp_request_timing(ctx);
+	}
+}
+
 /*---------------------------------------------------------------------------*/
 static void *rtp_thread_func(void *arg) {
 	fd_set fds;
 	int i, sock = -1;
-	int count = 0;
-	bool ntp_sent;
+	uint32_t scanned = 0;
 	raopst_t *ctx = (raopst_t*) arg;
 
 	for (i = 0; i < 3; i++) {
 		if (ctx->rtp_sockets[i].sock > sock) sock = ctx->rtp_sockets[i].sock;
 		// send synchro requests 3 times
-		ntp_sent = rtp_request_timing(ctx);
+		ctx->synchro.ntp_sent = rtp_request_timing(ctx);
 	}
 
 	while (ctx->running) {
-		ssize_t plen;
-		char type, packet[MAX_PACKET];
-		socklen_t rtp_client_len = sizeof(struct sockaddr_storage);
-		int idx = 0;
-		char *pktp = packet;
-		struct timeval timeout = {0, 50*1000};
+		struct timeval timeout = {0, LOSS_SCAN_MS*1000};
+		uint32_t now = gettime_ms();
+
+		// missing frames are looked for at a steady pace, whatever the traffic
+		if (now - scanned >= LOSS_SCAN_MS) {
+			rtp_scan_losses(ctx);
+			scanned = now;
+		}
 
 		FD_ZERO(&fds);
 		for (i = 0; i < 3; i++)	{ FD_SET(ctx->rtp_sockets[i].sock, &fds); }
 
 		if (select(sock + 1, &fds, NULL, NULL, &timeout) <= 0) continue;
 
-		for (i = 0; i < 3; i++)
-			if (FD_ISSET(ctx->rtp_sockets[i].sock, &fds)) idx = i;
+		for (i = 0; i < 3; i++) {
+			if (FD_ISSET(ctx->rtp_sockets[i].sock, &fds)) rtp_drain(ctx, i);
+		}
+	}
+
+	LOG_INFO("[%p]: terminating", ctx);
 
-		plen = recvfrom(ctx->rtp_sockets[idx].sock, packet, sizeof(packet), 0, (struct sockaddr*) &ctx->rtp_host, &rtp_client_len);
+	return NULL;
+}
 
-		if (!ntp_sent) {
-			LOG_WARN("[%p]: NTP request not sent yet", ctx);
-			ntp_sent = rtp_request_timing(ctx);
-		}
+/*---------------------------------------------------------------------------*/
+static void rtp_reactor_cb(void *owner, int fd) {
+	raopst_t *ctx = (raopst_t*) owner;
 
-		if (plen < 0) continue;
-		assert(plen <= MAX_PACKET);
+	// reactor can run the 3 sockets in parallel but packets handlers share state
+	pthread_mutex_lock(&ctx->reactor.rtp_mutex);
 
-		type = packet[1] & ~0x80;
-		pktp = packet;
+	for (int i = 0; i < 3; i++) {
+		if (ctx->rtp_sockets[i].sock == fd) rtp_drain(ctx, i);
+	}
 
-		switch (type) {
-			seq_t seqno;
-			unsigned rtptime;
+	pthread_mutex_unlock(&ctx->reactor.rtp_mutex);
+}
 
-			// re-sent packet
-			case 0x56: {
-				pktp += 4;
-				plen -= 4;
-			}
+/*---------------------------------------------------------------------------*/
+// returns true when packet is audio, to be queued
+static bool rtp_handle_packet(raopst_t *ctx, char *packet, ssize_t plen, rtp_audio_t *audio) {
+	char type, *pktp = packet;
 
-			// data packet
-			case 0x60: {
-				seqno = ntohs(*(uint16_t*)(pktp+2));
-				rtptime = ntohl(*(uint32_t*)(pktp+4));
+	if (plen < 2) return false;
+	assert(plen <= MAX_PACKET);
 
-				// adjust pointer and length
-				pktp += 12;
-				plen -= 12;
+	type = packet[1] & ~0x80;
 
-				LOG_SDEBUG("[%p]: seqno:%hu rtp:%u (type: %x, first: %u)", ctx, seqno, rtptime, type, packet[1] & 0x80);
+	switch (type) {
+		seq_t seqno;
+		unsigned rtptime;
 
-				// check if packet contains enough content to be reasonable
-				if (plen < 16) break;
+		// re-sent packet
+		case 0x56: {
+			pktp += 4;
+			plen -= 4;
+		}
 
-				if ((packet[1] & 0x80) && (type != 0x56)) {
-					LOG_INFO("[%p]: 1st audio packet received %hu", ctx, seqno);
-				}
+		// data packet
+		case 0x60: {
+			seqno = ntohs(*(uint16_t*)(pktp+2));
+			rtptime = ntohl(*(uint32_t*)(pktp+4));
 
-				buffer_put_packet(ctx, seqno, rtptime, packet[1] & 0x80, pktp, plen);
-				break;
+			// adjust pointer and length
+			pktp += 12;
+			plen -= 12;
+
+			LOG_SDEBUG("[%p]: seqno:%hu rtp:%u (type: %x, first: %u)", ctx, seqno, rtptime, type, packet[1] & 0x80);
+
+			// check if packet contains enough content to be reasonable
+			if (plen < 16) break;
+
+			if ((packet[1] & 0x80) && (type != 0x56)) {
+				LOG_INFO("[%p]: 1st audio packet received %hu", ctx, seqno);
 			}
 
-			// sync packet
-			case 0x54: {
-				uint32_t rtp_now_latency = ntohl(*(uint32_t*)(pktp+4));
-				uint32_t rtp_now = ntohl(*(uint32_t*)(pktp+16));
+			*audio = (rtp_audio_t) { seqno, rtptime, packet[1] & 0x80, pktp, plen };
+			return true;
+		}
 
-				pthread_mutex_lock(&ctx->ab_mutex);
+		// sync packet
+		case 0x54: {
+			uint32_t rtp_now_latency = ntohl(*(uint32_t*)(pktp+4));
+			uint32_t rtp_now = ntohl(*(uint32_t*)(pktp+16));
 
-				// memorize that remote timing for when NTP adjustment arrives
-				ctx->timing.rtp_remote = (((uint64_t)ntohl(*(uint32_t*)(pktp + 8))) << 32) + ntohl(*(uint32_t*)(pktp + 12));
+			pthread_mutex_lock(&ctx->ab_mutex);
 
-				// re-align timestamp and expected local playback time
-				if (!ctx->latency) ctx->latency = rtp_now - rtp_now_latency;
-				ctx->synchro.rtp = rtp_now - ctx->latency;
+			// memorize that remote timing for when NTP adjustment arrives
+			ctx->timing.rtp_remote = (((uint64_t)ntohl(*(uint32_t*)(pktp + 8))) << 32) + ntohl(*(uint32_t*)(pktp + 12));
 
-				// now we are synced on RTP frames
-				if ((ctx->synchro.status & RTP_SYNC) == 0) {
-					ctx->synchro.status |= RTP_SYNC;
-					LOG_INFO("[%p]: 1st RTP packet received", ctx);
-				}
+			// apply hold depth changed by raopst_set_latency, 0 is sender's latency
+			int request = atomic_exchange(&ctx->adapt.request, -1);
+			if (request >= 0) {
+				ctx->adapt.enabled = request & 1;
+				ctx->adapt.max = ((request >> 1) * 44100) / 1000;
+				if (!ctx->adapt.enabled || ctx->latency > ctx->adapt.max) ctx->latency = ctx->adapt.max;
+			}
 
-				// 1st sync packet received (signals a restart of playback)
-				if (packet[0] & 0x10) {
-					ctx->synchro.first = true;
-					LOG_INFO("[%p]: 1st sync packet received", ctx);
-				}
+			// re-align timestamp and expected local playback time
+			if (!ctx->latency) ctx->latency = rtp_now - rtp_now_latency;
+			if (ctx->adapt.enabled) adapt_latency(ctx, rtp_now - rtp_now_latency);
+			ctx->synchro.rtp = rtp_now - ctx->latency;
+
+			// now we are synced on RTP frames
+			if ((ctx->synchro.status & RTP_SYNC) == 0) {
+				ctx->synchro.status |= RTP_SYNC;
+				// HTTP does not wait for frames until fully synced
+				if (ctx->synchro.status & NTP_SYNC) http_sched_wake(ctx);
+				LOG_INFO("[%p]: 1st RTP packet received", ctx);
+			}
 
-				// we can't adjust timing if we don't have NTP
-				if (ctx->synchro.status & NTP_SYNC) {
-					ctx->synchro.time = ctx->timing.local + (uint32_t)NTP2MS(ctx->timing.rtp_remote - ctx->timing.remote);
-					LOG_DEBUG("[%p]: sync packet rtp_latency:%u rtp:%u remote ntp:%" PRIx64 ", local time % u(now: % u)",
-						ctx, rtp_now_latency, rtp_now, ctx->timing.rtp_remote, ctx->synchro.time, gettime_ms());
-				} else {
-					LOG_INFO("[%p]: NTP not acquired yet", ctx);
-				}
+			// 1st sync packet received (signals a restart of playback)
+			if (packet[0] & 0x10) {
+				ctx->synchro.first = true;
+				LOG_INFO("[%p]: 1st sync packet received", ctx);
+			}
 
-				pthread_mutex_unlock(&ctx->ab_mutex);
+			// we can't adjust timing if we don't have NTP
+			if (ctx->synchro.status & NTP_SYNC) {
+				ctx->synchro.time = ntp_local_ms(ctx, ctx->timing.rtp_remote);
+				LOG_DEBUG("[%p]: sync packet rtp_latency:%u rtp:%u remote ntp:%" PRIx64 ", local time % u(now: % u)",
+					ctx, rtp_now_latency, rtp_now, ctx->timing.rtp_remote, ctx->synchro.time, gettime_ms());
+			} else {
+				LOG_INFO("[%p]: NTP not acquired yet", ctx);
+			}
 
-				if (!count--) {
-					rtp_request_timing(ctx);
-					count = 3;
-				}
+			pthread_mutex_unlock(&ctx->ab_mutex);
+
+			if (!ctx->synchro.count--) {
+				rtp_request_timing(ctx);
+				ctx->synchro.count = 3;
+			}
+			break;
+		}
+
+		// NTP timing packet
+		case 0x53: {
+			int64_t delta = 0, thres;
+			uint64_t sent = (((uint64_t) ntohl(*(uint32_t*)(pktp+8))) << 32) + ntohl(*(uint32_t*)(pktp+12));
+			uint64_t remote_rx = (((uint64_t) ntohl(*(uint32_t*)(pktp+16))) << 32) + ntohl(*(uint32_t*)(pktp+20));
+			uint64_t remote_tx = (((uint64_t) ntohl(*(uint32_t*)(pktp+24))) << 32) + ntohl(*(uint32_t*)(pktp+28));
+			uint64_t received = gettime_local_us();
+
+			// better discard sync packets when roundtrip is suspicious and get another one
+			if (received - sent > 100000) {
+				LOG_WARN("[%p]: discarding NTP roundtrip of %" PRIu64 " us", ctx, received - sent);
 				break;
 			}
 
-			// NTP timing packet
-			case 0x53: {
-				uint64_t expected;
-				int64_t delta = 0;
-				uint32_t reference   = ntohl(*(uint32_t*)(pktp+12)); // only low 32 bits in our case
-				uint64_t remote 	  =(((uint64_t) ntohl(*(uint32_t*)(pktp+16))) << 32) + ntohl(*(uint32_t*)(pktp+20));
-				uint32_t roundtrip   = gettime_ms() - reference;
-
-				// better discard sync packets when roundtrip is suspicious and get another one
-				if (roundtrip > 100) {
-					LOG_WARN("[%p]: discarding NTP roundtrip of %u ms", ctx, roundtrip);
-					break;
+			ntp_estimate(ctx, sent, NTP2US(remote_rx), NTP2US(remote_tx), received);
+			ctx->timing.count++;
+
+			/*
+			  Drift is how much remote clock has moved from local one since
+			  estimation was good enough. What has already been corrected is
+			  in gap_adjust. A half-full window is needed for a meaningful skew
+			*/
+			if (!ctx->timing.drift && (ctx->synchro.status & NTP_SYNC) &&
+				ctx->timing.est.error <= NTP_ERROR_MAX && ctx->timing.est.count >= NTP_WINDOW / 2) {
+				int64_t drift;
+
+				if (!ctx->timing.est.based) {
+					ctx->timing.est.base = ctx->timing.est.offset;
+					ctx->timing.est.based = true;
 				}
 
+				drift = (ctx->timing.est.base - ctx->timing.est.offset) / 1000;
+				delta = drift + ctx->timing.gap_adjust - ctx->timing.gap_sum;
+				ctx->timing.gap_sum += delta;
+
+				pthread_mutex_lock(&ctx->ab_mutex);
+
+				// resampler corrects continuously, frames are only added/removed when too far
+				if (ctx->resample.enabled) resample_adjust(ctx);
+				thres = ctx->resample.enabled ? RESAMPLE_JUMP_MS : GAP_THRES;
+
 				/*
-				  The expected elapsed remote time should be exactly the same as
-				  elapsed local time between the two request, corrected by the
-				  drifting
+				 if expected time is more than remote, then our time is
+				 running faster and we are transmitting frames too quickly,
+				 so we'll run out of frames, need to add one
 				*/
-				expected = ctx->timing.remote + MS2NTP(reference - ctx->timing.local);
-
-				ctx->timing.remote = remote;
-				ctx->timing.local = reference;
-				ctx->timing.count++;
-
-				if (!ctx->timing.drift && (ctx->synchro.status & NTP_SYNC)) {
-					delta = NTP2MS((int64_t) expected - (int64_t) ctx->timing.remote);
-					ctx->timing.gap_sum += delta;
-
-					pthread_mutex_lock(&ctx->ab_mutex);
-
-					/*
-					 if expected time is more than remote, then our time is
-					 running faster and we are transmitting frames too quickly,
-					 so we'll run out of frames, need to add one
-					*/
-					if (ctx->timing.gap_sum > GAP_THRES && ctx->timing.gap_count++ > GAP_COUNT) {
-						LOG_INFO("[%p]: Sending packets too fast %" PRId64 " [W:% hu R : % hu]", ctx, ctx->timing.gap_sum, ctx->ab_write, ctx->ab_read);
-						ctx->ab_read--;
-						ctx->audio_buffer[BUFIDX(ctx->ab_read)].ready = 1;
-						ctx->timing.gap_sum -= GAP_THRES;
-						ctx->timing.gap_adjust -= GAP_THRES;
-					/*
-					 if expected time is less than remote, then our time is
-					 running slower and we are transmitting frames too slowly,
-					 so we'll overflow frames buffer, need to remove one
-					*/
-					} else if (ctx->timing.gap_sum < -GAP_THRES && ctx->timing.gap_count++ > GAP_COUNT) {
-						if (seq_order(ctx->ab_read, ctx->ab_write)) {
-							ctx->audio_buffer[BUFIDX(ctx->ab_read)].ready = 0;
-							ctx->ab_read++;
-						} else ctx->skip++;
-						ctx->timing.gap_sum += GAP_THRES;
-						ctx->timing.gap_adjust += GAP_THRES;
-						LOG_INFO("[%p]: Sending packets too slow %" PRId64 " (skip: % d)[W:% hu R : % hu]", ctx, ctx->timing.gap_sum, ctx->skip, ctx->ab_write, ctx->ab_read);
-					}
-
-					if (llabs(ctx->timing.gap_sum) < 8) ctx->timing.gap_count = 0;
-
-					pthread_mutex_unlock(&ctx->ab_mutex);
+				if (ctx->timing.gap_sum > thres && ctx->timing.gap_count++ > GAP_COUNT) {
+					LOG_INFO("[%p]: Sending packets too fast %" PRId64 " [W:% hu R : % hu]", ctx, ctx->timing.gap_sum, ctx->ab_write, ctx->ab_read);
+					ctx->ab_read--;
+					buffer_set(ctx->audio_buffer.ready, ctx->ab_read, true);
+					ctx->timing.gap_sum -= GAP_THRES;
+					ctx->timing.gap_adjust -= GAP_THRES;
+					STAT_ADD(ctx, drift.added, 1);
+				/*
+				 if expected time is less than remote, then our time is
+				 running slower and we are transmitting frames too slowly,
+				 so we'll overflow frames buffer, need to remove one
+				*/
+				} else if (ctx->timing.gap_sum < -thres && ctx->timing.gap_count++ > GAP_COUNT) {
+					if (seq_order(ctx->ab_read, ctx->ab_write)) {
+						buffer_set(ctx->audio_buffer.ready, ctx->ab_read, false);
+						ctx->ab_read++;
+					} else ctx->skip++;
+					ctx->timing.gap_sum += GAP_THRES;
+					ctx->timing.gap_adjust += GAP_THRES;
+					STAT_ADD(ctx, drift.removed, 1);
+					LOG_INFO("[%p]: Sending packets too slow %" PRId64 " (skip: % d)[W:% hu R : % hu]", ctx, ctx->timing.gap_sum, ctx->skip, ctx->ab_write, ctx->ab_read);
 				}
 
-				// re-adjust the synchro time in case it could not have been done by first RTP because NTP was missing
-				ctx->synchro.time = ctx->timing.local + (uint32_t)NTP2MS(ctx->timing.rtp_remote - ctx->timing.remote);
+				if (llabs(ctx->timing.gap_sum) < 8) ctx->timing.gap_count = 0;
 
-				// now we are synced on NTP (mutex not needed)
-				if ((ctx->synchro.status & NTP_SYNC) == 0) {
-					LOG_INFO("[%p]: 1st NTP packet received", ctx);
-					ctx->synchro.status |= NTP_SYNC;
-				}
+				pthread_mutex_unlock(&ctx->ab_mutex);
+			}
 
-				LOG_DEBUG("[%p]: Timing references local:%" PRIu64 ", remote: %" PRIx64 " (delta : %" PRId64 ", sum : %" PRId64 ", adjust : %" PRId64 ", gaps : % d)",
-						  ctx, ctx->timing.local, ctx->timing.remote, delta, ctx->timing.gap_sum, ctx->timing.gap_adjust, ctx->timing.gap_count);
-				break;
+			// re-adjust the synchro time in case it could not have been done by first RTP because NTP was missing
+			ctx->synchro.time = ntp_local_ms(ctx, ctx->timing.rtp_remote);
+
+			// now we are synced on NTP (mutex not needed)
+			if ((ctx->synchro.status & NTP_SYNC) == 0) {
+				LOG_INFO("[%p]: 1st NTP packet received", ctx);
+				ctx->synchro.status |= NTP_SYNC;
+				if (ctx->synchro.status & RTP_SYNC) http_sched_wake(ctx);
 			}
+
+			LOG_DEBUG("[%p]: Timing offset:%" PRId64 " us skew:%+.1f ppm error:%u us (delta : %" PRId64 ", sum : %" PRId64 ", adjust : %" PRId64 ", gaps : % d)",
+					  ctx, ctx->timing.est.offset, ctx->timing.est.skew * 1000000, ctx->timing.est.error, delta, ctx->timing.gap_sum, ctx->timing.gap_adjust, ctx->timing.gap_count);
+			break;
 		}
 	}
 
-	LOG_INFO("[%p]: terminating", ctx);
+	return false;
+}
 
-	return NULL;
+/*---------------------------------------------------------------------------*/
+// monotonic, unlike wall clock that would be disciplined by NTP and distort skew
+static uint64_t gettime_local_us(void) {
+#if WIN
+	return gettime_us();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+/*---------------------------------------------------------------------------*/
+// add one exchange (remote times in us of remote clock) and update offset & skew
+static void ntp_estimate(raopst_t *ctx, uint64_t sent, int64_t remote_rx, int64_t remote_tx, uint64_t received) {
+	struct timing_s *timing = &ctx->timing;
+	int64_t rtt = (int64_t) (received - sent) - (remote_tx - remote_rx), limit;
+	uint32_t min_rtt = UINT32_MAX;
+	double sx = 0, sy = 0, sxx = 0, sxy = 0, res = 0;
+	int n = 0, best = 0;
+
+	// offset between clocks at the middle of the exchange
+	timing->est.samples[timing->est.next].local = sent + (received - sent) / 2;
+	timing->est.samples[timing->est.next].offset = remote_rx + (remote_tx - remote_rx) / 2 - (int64_t) timing->est.samples[timing->est.next].local;
+	timing->est.samples[timing->est.next].rtt = max(rtt, 0);
+	timing->est.ref = timing->est.samples[timing->est.next].local;
+	timing->est.next = (timing->est.next + 1) % NTP_WINDOW;
+	timing->est.count = min(timing->est.count + 1, NTP_WINDOW);
+
+	for (int i = 0; i < timing->est.count; i++) {
+		if (timing->est.samples[i].rtt >= min_rtt) continue;
+		min_rtt = timing->est.samples[i].rtt;
+		best = i;
+	}
+
+	// larger roundtrips have been delayed one way or the other, offset is meaningless
+	limit = min_rtt + max(min_rtt / 2, 500);
+
+	// regression around best sample, values are small enough for doubles
+	for (int i = 0; i < timing->est.count; i++) {
+		double x, y;
+		if (timing->est.samples[i].rtt > limit) continue;
+		x = (int64_t) (timing->est.samples[i].local - timing->est.ref);
+		y = timing->est.samples[i].offset - timing->est.samples[best].offset;
+		sx += x; sy += y; sxx += x * x; sxy += x * y;
+		n++;
+	}
+
+	// skew needs a few seconds of span, otherwise keep previous one
+	if (n >= 3 && sxx * n - sx * sx > 1e12 * n * n) {
+		timing->est.skew = (n * sxy - sx * sy) / (n * sxx - sx * sx);
+		timing->est.skew = max(min(timing->est.skew, NTP_SKEW_MAX), -NTP_SKEW_MAX);
+	}
+
+	timing->est.offset = timing->est.samples[best].offset + (sy - timing->est.skew * sx) / n;
+
+	for (int i = 0; i < timing->est.count; i++) {
+		double r;
+		if (timing->est.samples[i].rtt > limit) continue;
+		r = timing->est.samples[i].offset - timing->est.offset - timing->est.skew * (int64_t) (timing->est.samples[i].local - timing->est.ref);
+		res += r * r;
+	}
+
+	// a sample is off by half its roundtrip at most, then spread around fit
+	timing->est.error = min_rtt / 2 + sqrt(res / n);
+}
+
+/*---------------------------------------------------------------------------*/
+// local time (same as gettime_ms) when remote clock reaches ntp
+static uint32_t ntp_local_ms(raopst_t *ctx, uint64_t ntp) {
+	int64_t local = NTP2US(ntp) - ctx->timing.est.offset;
+
+	// skew is tiny so the offset at that local time is close enough
+	local -= ctx->timing.est.skew * (local - (int64_t) ctx->timing.est.ref);
+
+	return gettime_ms() + (local - (int64_t) gettime_local_us()) / 1000;
 }
 
 /*---------------------------------------------------------------------------*/
 static bool rtp_request_timing(raopst_t *ctx) {
 	unsigned char req[32];
-	uint32_t now = gettime_ms();
+	uint64_t now = gettime_local_us();
 	int i;
 	struct sockaddr_in host;
 
-	LOG_DEBUG("[%p]: timing request now:%u (port: %hu)", ctx, now, ctx->rtp_sockets[TIMING].rport);
+	LOG_DEBUG("[%p]: timing request now:%" PRIu64 " (port: %hu)", ctx, now, ctx->rtp_sockets[TIMING].rport);
 
 	req[0] = 0x80;
 	req[1] = 0x52|0x80;
 	*(uint16_t*)(req+2) = htons(7);
 	*(uint32_t*)(req+4) = htonl(0);  // dummy
 	for (i = 0; i < 16; i++) req[i+8] = 0;
-	*(uint32_t*)(req+24) = 0;
-	*(uint32_t*)(req+28) = htonl(now); // this is not a real NTP, but a 32 ms counter in the low part of the NTP
+	// this is not a real NTP but local time in us, it is echoed as is in the reply
+	*(uint32_t*)(req+24) = htonl(now >> 32);
+	*(uint32_t*)(req+28) = htonl(now);
 
 	if (ctx->peer.s_addr != INADDR_ANY) {
 		host.sin_family = AF_INET;
@@ -793,6 +1349,51 @@ static bool rtp_request_timing(raopst_t *ctx) {
 	return true;
 }
 
+/*---------------------------------------------------------------------------*/
+static void rtp_timer_cb(void *owner, int fd) {
+	rtp_scan_losses((raopst_t*) owner);
+}
+
+/*---------------------------------------------------------------------------*/
+// request missing frames that are due in coalesced ranges, each frame backs off on its own
+static void rtp_scan_losses(raopst_t *ctx) {
+	abuf_t *abuf = &ctx->audio_buffer;
+	uint32_t now = gettime_ms();
+	seq_t seqno, end, first = 0;
+	bool pending = false;
+
+	pthread_mutex_lock(&ctx->ab_mutex);
+
+	// don't bother requesting for resend if we are not playing yet
+	if (ctx->state != RTP_PLAY) {
+		pthread_mutex_unlock(&ctx->ab_mutex);
+		return;
+	}
+
+	for (seqno = ctx->ab_read, end = ctx->ab_write + 1; seq_order(seqno, end); seqno++) {
+		int idx = BUFIDX(seqno);
+		// words of received frames are skipped at once (ring and seqno both wrap on 64)
+		bool skip = !(idx % 64) && abuf->ready[idx / 64] == ~0ULL && seq_order(seqno + 63, end);
+		bool due = !skip && !buffer_bit(abuf->ready, seqno) && now - abuf->last_resend[idx] > (uint32_t) (RESEND_TO << abuf->tries[idx]);
+
+		if (due) {
+			abuf->last_resend[idx] = now;
+			if (abuf->tries[idx] < RESEND_BACKOFF) abuf->tries[idx]++;
+			if (!pending) first = seqno;
+			pending = true;
+		} else if (pending) {
+			rtp_request_resend(ctx, first, seqno - 1);
+			pending = false;
+		}
+
+		if (skip) seqno += 63;
+	}
+
+	if (pending) rtp_request_resend(ctx, first, seqno - 1);
+
+	pthread_mutex_unlock(&ctx->ab_mutex);
+}
+
 /*---------------------------------------------------------------------------*/
 static bool rtp_request_resend(raopst_t *ctx, seq_t first, seq_t last) {
 	unsigned char req[8];    // *not* a standard RTCP NACK
@@ -801,6 +1402,7 @@ static bool rtp_request_resend(raopst_t *ctx, seq_t first, seq_t last) {
 	if (seq_order(last, first) || last - first > BUFFER_FRAMES / 2) return false;
 
 	ctx->resent_frames += (seq_t) (last - first) + 1;
+	STAT_ADD(ctx, frames.requested, (seq_t) (last - first) + 1);
 
 	LOG_DEBUG("resend request [W:%hu R:%hu first=%hu last=%hu]", ctx->ab_write, ctx->ab_read, first, last);
 
@@ -810,9 +1412,10 @@ static bool rtp_request_resend(raopst_t *ctx, seq_t first, seq_t last) {
 	*(uint16_t*)(req+4) = htons(first);  // missed seqnum
 	*(uint16_t*)(req+6) = htons((seq_t) (last-first)+1);  // count
 
-	ctx->rtp_host.sin_port = htons(ctx->rtp_sockets[CONTROL].rport);
+	struct sockaddr_in host = ctx->rtp_host;
+	host.sin_port = htons(ctx->rtp_sockets[CONTROL].rport);
 
-	if (sizeof(req) != sendto(ctx->rtp_sockets[CONTROL].sock, req, sizeof(req), 0, (struct sockaddr*) &ctx->rtp_host, sizeof(ctx->rtp_host))) {
+	if (sizeof(req) != sendto(ctx->rtp_sockets[CONTROL].sock, req, sizeof(req), 0, (struct sockaddr*) &host, sizeof(host))) {
 		LOG_WARN("[%p]: SENDTO failed (%s)", ctx, strerror(errno));
 	}
 
@@ -822,6 +1425,8 @@ static bool rtp_request_resend(raopst_t *ctx, seq_t first, seq_t last) {
 /*---------------------------------------------------------------------------*/
 // get the next frame, when available. return 0 if underrun/stream reset.
 static short *_buffer_get_frame(raopst_t *ctx, size_t *bytes) {
+	ctx->http_sched.waiting = false;
+
 	// no frame (even silence) when not playing and not synchronized
 	if (ctx->state != RTP_PLAY || ctx->synchro.status != (RTP_SYNC | NTP_SYNC)) return NULL;
 
@@ -833,7 +1438,7 @@ static short *_buffer_get_frame(raopst_t *ctx, size_t *bytes) {
 
 	// skip frames if we are running late and skip could not be done in SYNC
 	while (ctx->skip && seq_order(ctx->ab_read, ctx->ab_write)) {
-		ctx->audio_buffer[BUFIDX(ctx->ab_read)].ready = 0;
+		buffer_set(ctx->audio_buffer.ready, ctx->ab_read, false);
 		ctx->ab_read++;
 		ctx->skip--;
 		LOG_INFO("[%p]: Sending packets too slow (skip: %d) [W:%hu R:%hu]", ctx, ctx->skip, ctx->ab_write, ctx->ab_read);
@@ -849,61 +1454,67 @@ static short *_buffer_get_frame(raopst_t *ctx, size_t *bytes) {
 		buf_fill = ctx->ab_write - ctx->ab_read + 1;
 	}
 
-	abuf_t* curframe = ctx->audio_buffer + BUFIDX(ctx->ab_read);
-
-	// try to request resend missing packet in order, explore up to 64 frames
-	for (int step = max(buf_fill / 64, 1), i = 0, first = 0; seq_order(ctx->ab_read + i, ctx->ab_write); i += step) {
-		abuf_t* frame = ctx->audio_buffer + BUFIDX(ctx->ab_read + i);
-
-		// stop when we reach a ready frame or a recent pending resend
-		if (first && (frame->ready || now - frame->last_resend <= RESEND_TO)) {
-			if (!rtp_request_resend(ctx, first, ctx->ab_read + i - 1)) break;
-			first = 0;
-			i += step - 1;
-		} else if (!frame->ready && now - frame->last_resend > RESEND_TO) {
-			if (!first) first = ctx->ab_read + i;
-			frame->last_resend = now;
-		}
-	}
+	abuf_t* abuf = &ctx->audio_buffer;
+	seq_t current = ctx->ab_read;
+	bool ready = buffer_bit(abuf->ready, current);
 
 	// use and update previous frame when buffer is empty (previous is always valid)
-	if (!buf_fill) curframe->rtptime = ctx->audio_buffer[BUFIDX(ctx->ab_read - 1)].rtptime + ctx->frame_size;
+	if (!buf_fill) abuf->rtptime[BUFIDX(current)] = abuf->rtptime[BUFIDX(current - 1)] + ctx->frame_size;
 
 	// watch out for 32 bits overflow
-	uint32_t playtime = ctx->synchro.time + (((int32_t)(curframe->rtptime - ctx->synchro.rtp)) * 1000) / 44100;
-	LOG_SDEBUG("playtime %u %d [W:%hu R:%hu] %d", playtime, playtime - now, ctx->ab_write, ctx->ab_read, curframe->ready);
+	uint32_t playtime = ctx->synchro.time + (((int32_t)(abuf->rtptime[BUFIDX(current)] - ctx->synchro.rtp)) * 1000) / 44100;
+	LOG_SDEBUG("playtime %u %d [W:%hu R:%hu] %d", playtime, playtime - now, ctx->ab_write, ctx->ab_read, ready);
 
 	// wait if frame is not ready and we have time or if we have no frame and are not allowed to fill
-	if (!curframe->ready && (now < playtime || (!buf_fill && !ctx->http_fill))) {
+	if (!ready && (now < playtime || (!buf_fill && !ctx->http_fill))) {
+		// frame will be played at playtime if we can fill, otherwise when it's received
+		ctx->http_sched.waiting = true;
+		ctx->http_sched.due = buf_fill || ctx->http_fill;
+		ctx->http_sched.playtime = playtime;
 		LOG_SDEBUG("[%p]: waiting (fill:%hd, W:%hu R:%hu) now:%u, playtime:%u, wait:%d", ctx, buf_fill, ctx->ab_write, ctx->ab_read, now, playtime, playtime - now);
 		return NULL;
 	}
 
 	/* I'm not 100% sure that all cases where audio_buffer should be reset are handled so there is a 
-	 * chance that we end-up here with curframe->ready but from an old frame. To avoid that to create a 
+	 * chance that we end-up here with current frame ready but from an old frame. To avoid that to create a 
 	 * mess we'll verify first that buffer is empty. We can be there anyway if case we do filling */
 	if (!buf_fill) {
 		// when silence is inserted at the top, need to move write pointer as well
 		ctx->ab_write++;
 		ctx->filled_frames++;
-		curframe->ready = 0;
-	} else if (!curframe->ready) {
+		STAT_ADD(ctx, frames.filled, 1);
+		buffer_set(abuf->ready, current, false);
+		ready = false;
+	} else if (!ready) {
 		ctx->silent_frames++;
-		curframe->missed = true;
+		STAT_ADD(ctx, frames.silent, 1);
+		buffer_set(abuf->missed, current, true);
 	} else {
+		// HTTP is draining later than playtime, hold depth must cover that
+		if ((int32_t) (now - playtime) > 0) ctx->adapt.lag = max(ctx->adapt.lag, now - playtime);
 		LOG_SDEBUG("[%p]: prepared frame (fill:%hd, W:%hu R:%hu)", ctx, buf_fill - 1, ctx->ab_write, ctx->ab_read);
 	}
 
-	if (!curframe->ready) {
+	if (!ready) {
 		LOG_DEBUG("[%p]: created zero frame at %d (W:%hu R:%hu)", ctx, now - playtime, ctx->ab_write, ctx->ab_read);
-		memset(curframe->data, 0, ctx->frame_size * 4);
+		memset(ctx->pcm, 0, ctx->frame_size * 4);
 		*bytes = ctx->frame_size * 4;
 	} else {
-		*bytes = curframe->len;
-		curframe->ready = 0;
+		int size;
+		uint64_t start = gettime_local_us();
+		// only frames that are actually played are decoded
+		alac_decode(ctx, ctx->pcm, BUFDATA(abuf, current), abuf->len[BUFIDX(current)], &size);
+		raop_hist_add(ctx->stats + STAT(decode), gettime_local_us() - start);
+		*bytes = size;
+		buffer_set(abuf->ready, current, false);
+#ifdef __RTP_STORE
+		fwrite(ctx->pcm, size, 1, ctx->rtpOUT);
+#endif
 	}
 
 	// a bit of logging from time to time or when we have a network blackout
+	STAT_ADD(ctx, frames.played, 1);
+
 	if (!(ctx->out_frames++ & 0xfff) || (!(ctx->out_frames & 0x3f) && buf_fill >= 25 && ctx->state == RTP_PLAY) || ctx->filled_frames > 100) {
 		LOG_INFO("[%p]: drain [level:%hd gap:%d] [W:%hu R:%hu] [R:%u S:%u F:%u]",
 					ctx, buf_fill-1, playtime - now, ctx->ab_write, ctx->ab_read,
@@ -912,65 +1523,201 @@ static short *_buffer_get_frame(raopst_t *ctx, size_t *bytes) {
 	}
 
 	ctx->ab_read++;
-	return curframe->data;
+	return ctx->pcm;
 }
 
 /*---------------------------------------------------------------------------*/
-int send_data(bool chunked, int sock, const void *data, int size, int flags) {
-	if (!chunked) return send(sock, data, size, flags);
-
+// send buffers at once (as one chunk if needed), returns bytes of payload sent
+static ssize_t send_iov(bool chunked, int sock, struct iovec *iov, int count) {
+	struct iovec vec[HTTP_MAX_IOV + 2];
 	char chunk[16];
-	itoa(size, chunk, 16);
-	strcat(chunk, "\r\n");
+	size_t size = 0, head = 0;
+	ssize_t sent = 0;
+	int i = 0, n = 0;
+
+	assert(count <= HTTP_MAX_IOV);
 
-	send(sock, chunk, strlen(chunk), flags);
-	size = send(sock, data, size, flags);
-	send(sock, "\r\n", 2, flags);
+	for (int j = 0; j < count; j++) size += iov[j].iov_len;
 
-	return size;
+	if (chunked) {
+		itoa(size, chunk, 16);
+		strcat(chunk, "\r\n");
+		head = strlen(chunk);
+		vec[n++] = (struct iovec) { chunk, head };
+	}
+
+	for (int j = 0; j < count; j++) if (iov[j].iov_len) vec[n++] = iov[j];
+	if (chunked) vec[n++] = (struct iovec) { "\r\n", 2 };
+
+	// socket is blocking but a signal or a timeout can still cut it short
+	while (i < n) {
+#if WIN
+		ssize_t rc = send(sock, vec[i].iov_base, vec[i].iov_len, 0);
+#else
+		struct msghdr msg = { 0 };
+		msg.msg_iov = vec + i;
+		msg.msg_iovlen = n - i;
+		ssize_t rc = sendmsg(sock, &msg, 0);
+#endif
+		if (rc <= 0) break;
+		sent += rc;
+
+		// skip what has been fully sent and adjust what has been partially
+		for (; i < n && (size_t) rc >= vec[i].iov_len; i++) rc -= vec[i].iov_len;
+		if (i < n) {
+			vec[i].iov_base = (uint8_t*) vec[i].iov_base + rc;
+			vec[i].iov_len -= rc;
+		}
+	}
+
+	if (!sent) return -1;
+	return min(max(sent - (ssize_t) head, 0), (ssize_t) size);
 }
 
 /*---------------------------------------------------------------------------*/
-static void *http_thread_func(void *arg) {
-	int frame_count = 0;
-	raopst_t *ctx = (raopst_t*) arg;
-	int sock = -1;
-	struct timeval timeout = { 0, 0 };
+static void http_accept(raopst_t *ctx) {
+	int i, on = 1, sock = accept(ctx->http_listener, NULL, NULL);
 
-	while (ctx->running) {
-		fd_set rfds;
+	if (sock == -1) return;
+
+	for (i = 0; i < MAX_HTTP_CLIENTS && ctx->http_clients[i].sock != -1; i++);
+
+	if (i == MAX_HTTP_CLIENTS) {
+		LOG_WARN("[%p]: too many HTTP connections, refusing %u", ctx, sock);
+		closesocket(sock);
+		return;
+	}
+
+	setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (char *) &on, sizeof(on));
+	raop_reactor_set_timeout(sock, HTTP_STALL_MS);
+	memset(ctx->http_clients + i, 0, sizeof(http_client_t));
+	ctx->http_clients[i].sock = sock;
+	http_sched_add(ctx, sock);
 
-		if (sock == -1) {
-			struct timeval timeout = {0, 50*1000};
+	LOG_INFO("[%p]: got HTTP connection %u", ctx, sock);
+}
+
+/*---------------------------------------------------------------------------*/
+static void http_close(raopst_t *ctx, http_client_t *client) {
+	LOG_INFO("HTTP close %u", client->sock);
+	// this also removes it from the HTTP event set
+	closesocket(client->sock);
+	client->sock = -1;
+	client->ready = false;
+}
 
-			FD_ZERO(&rfds);
-			FD_SET(ctx->http_listener, &rfds);
+/*---------------------------------------------------------------------------*/
+static void http_icy_update(raopst_t *ctx) {
+	char *format;
+
+	// there is room for 1 extra byte at the beginning for length
+	if (ctx->metadata.artwork) format = "NStreamTitle='%s%s%s';StreamURL='%s';";
+	else format = "NStreamTitle='%s%s%s';";
+	int len = snprintf(ctx->icy.block, ICY_LEN_MAX - 16, format, ctx->metadata.artist,
+					  ctx->metadata.artist ? " - " : "",
+					  ctx->metadata.title, ctx->metadata.artwork) - 1;
+	len = min(len, ICY_LEN_MAX - 16 - 2);
+	LOG_INFO("[%p]: ICY update %s", ctx, ctx->icy.block + 1);
+
+	int len_16 = (len + 15) / 16;
+	memset(ctx->icy.block + len + 1, 0, len_16 * 16 - len);
+	ctx->icy.block[0] = len_16;
+	ctx->icy.len = len_16 * 16 + 1;
+
+	// each client will send it at its next ICY interval
+	ctx->icy.version++;
+	ctx->icy.updated = false;
+	raopsr_metadata_free(&ctx->metadata);
+}
 
-			if (select(ctx->http_listener + 1, &rfds, NULL, NULL, &timeout) > 0) {
-				sock = accept(ctx->http_listener, NULL, NULL);
+/*---------------------------------------------------------------------------*/
+// send what client has not received yet, up to count, from the cache and with its own ICY blocks
+static bool http_client_send(raopst_t *ctx, http_client_t *client, size_t count) {
+	uint32_t gap = gettime_ms();
+
+	// stream has been reset underneath or client is too late, continue from live
+	if (client->pos > count || client->pos < raop_cache_start(ctx->http_cache)) client->pos = count;
+
+	while (client->pos != count) {
+		size_t bytes = min(count - client->pos, client->icy.active ? client->icy.remain : HTTP_SLICE);
+		size_t len = bytes;
+		struct iovec iov[3];
+		ssize_t sent;
+		int n = raop_cache_read(ctx->http_cache, client->pos, bytes, iov);
+
+		// ICY block is empty unless metadata have changed since the last one
+		if (client->icy.active && bytes == client->icy.remain) {
+			if (client->icy.version != ctx->icy.version) {
+				iov[n++] = (struct iovec) { ctx->icy.block, ctx->icy.len };
+				client->icy.version = ctx->icy.version;
+			} else {
+				iov[n++] = (struct iovec) { "", 1 };
 			}
+			len += iov[n - 1].iov_len;
+		}
 
-			if (sock != -1 && ctx->running) {
-				int on = 1;
-				setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (char *) &on, sizeof(on));
-				LOG_INFO("[%p]: got HTTP connection %u", ctx, sock);
-			} else continue;
+		sent = send_iov(client->chunked, client->sock, iov, n);
+
+		if (sent != len) {
+			LOG_WARN("[%p]: HTTP send() unexpected response: %li (data=%zu): %s", ctx, (long int) sent, len, strerror(errno));
+			return false;
 		}
 
-		FD_ZERO(&rfds);
-		FD_SET(sock, &rfds);
+		client->pos += bytes;
+
+		if (client->icy.active) {
+			client->icy.remain -= bytes;
+			if (!client->icy.remain) client->icy.remain = ctx->icy.interval;
+		}
+	}
+
+	gap = gettime_ms() - gap;
+
+	if (gap > 100) {
+		LOG_WARN("[%p]: spent %u ms in send to %u", ctx, gap, client->sock);
+	}
+
+	return true;
+}
+
+/*---------------------------------------------------------------------------*/
+// wait up to wait_us for connections or requests then send next frame, returns time to wait for next call
+static uint32_t http_serve(raopst_t *ctx, uint32_t wait_us) {
+	struct timeval timeout = { 0, wait_us };
+	fd_set rfds;
+	uint32_t next;
+	int16_t* pcm;
+	size_t bytes;
+	bool ready = false;
+	int n, sock = ctx->http_listener;
+
+	FD_ZERO(&rfds);
+	FD_SET(ctx->http_listener, &rfds);
+
+	for (int i = 0; i < MAX_HTTP_CLIENTS; i++) {
+		if (ctx->http_clients[i].sock == -1) continue;
+		FD_SET(ctx->http_clients[i].sock, &rfds);
+		sock = max(sock, ctx->http_clients[i].sock);
+	}
+
+	n = select(sock + 1, &rfds, NULL, NULL, &timeout);
 
-		int n = select(sock + 1, &rfds, NULL, NULL, &timeout);
+	// new client is not in rfds so it will be served next time
+	if (n > 0 && FD_ISSET(ctx->http_listener, &rfds)) http_accept(ctx);
+
+	pthread_mutex_lock(&ctx->ab_mutex);
+
+	for (int i = 0; i < MAX_HTTP_CLIENTS; i++) {
+		http_client_t *client = ctx->http_clients + i;
 		bool res = true;
 
-		pthread_mutex_lock(&ctx->ab_mutex);
+		if (client->sock == -1) continue;
 
-		if (n > 0) {
-			res = handle_http(ctx, sock);
-			ctx->http_ready = res;
+		if (n > 0 && FD_ISSET(client->sock, &rfds)) {
+			res = client->ready = handle_http(ctx, client);
 
 			// only send silence when it's the first GET (or after a flush)
-			if (!ctx->http_count) {
+			if (!raop_cache_count(ctx->http_cache)) {
 				// send just the right amount of silence (ab_xxx are always accurate)
 				short buf_fill = ctx->ab_write - ctx->ab_read + 1;
 				if (buf_fill >= 0) ctx->silence_count = ctx->delay - min(ctx->delay, buf_fill);
@@ -981,117 +1728,211 @@ static void *http_thread_func(void *arg) {
 		}
 
 		// terminate connection if required by HTTP peer
-		if (n < 0 || !res || ctx->close_socket) {
-			LOG_INFO("HTTP close %u", sock);
-			closesocket(sock);
-			sock = -1;
-			ctx->close_socket = ctx->http_ready = false;
-		}
+		if (n < 0 || !res || ctx->close_socket) http_close(ctx, client);
+		else ready |= client->ready;
+	}
 
-		int16_t* pcm;
-		size_t bytes;
+	ctx->close_socket = false;
 
-		// wait for session to be ready before sending (no need for mutex)
-		if (ctx->http_ready && (pcm = _buffer_get_frame(ctx, &bytes)) != NULL) {
-			size_t frames = bytes / 4;
-			uint8_t* data = encoder_encode(ctx->encoder, pcm, frames, &bytes);
+	// wait for one client to be ready before sending (no need for mutex)
+	if (ready && (pcm = _buffer_get_frame(ctx, &bytes)) != NULL) {
+		size_t frames = bytes / 4, count;
+		uint64_t start;
+		uint8_t* data;
 
-			if (bytes) {
-				uint32_t space, gap = gettime_ms();
-				int offset;
+		if (ctx->resample.enabled) pcm = resample_frame(ctx, pcm, &frames);
+		data = encoder_encode(ctx->encoder, pcm, frames, &bytes);
+		STAT_ADD(ctx, encoder.samples, frames);
+		STAT_ADD(ctx, encoder.bytes, bytes);
 
 #ifdef __RTP_STORE
-				fwrite(inbuf, len, 1, ctx->httpOUT);
+		fwrite(data, bytes, 1, ctx->httpOUT);
 #endif
-				// store data for a potential re-send
-				space = min(bytes, CACHE_SIZE - (ctx->http_count % CACHE_SIZE));
-				memcpy(ctx->http_cache + (ctx->http_count % CACHE_SIZE), data, space);
-				memcpy(ctx->http_cache, data + space, bytes - space);
-				ctx->http_count += bytes;
-
-				// check if ICY sending is active (len < ICY_INTERVAL)
-				if (ctx->icy.active && bytes > ctx->icy.remain) {
-					int len_16 = 0;
-					char buffer[ICY_LEN_MAX];
-
-					if (ctx->icy.updated) {
-						char *format;
-
-						// there is room for 1 extra byte at the beginning for length
-						if (ctx->metadata.artwork) format = "NStreamTitle='%s%s%s';StreamURL='%s';";
-						else format = "NStreamTitle='%s%s%s';";
-						int len = sprintf(buffer, format, ctx->metadata.artist,
-										 ctx->metadata.artist ? " - " : "",
-										 ctx->metadata.title, ctx->metadata.artwork) - 1;
-						LOG_INFO("[%p]: ICY update %s", ctx, buffer + 1);
-						len_16 = (len + 15) / 16;
-						memset(buffer + len + 1, 0, len_16 * 16 - len);
-						ctx->icy.updated = false;
-						raopsr_metadata_free(&ctx->metadata);
-					}
-
-					buffer[0] = len_16;
-
-					// release mutex here as send might take a while
-					pthread_mutex_unlock(&ctx->ab_mutex);
-
-					// send remaining data first
-					offset = ctx->icy.remain;
-					if (offset) send_data(ctx->http_length == -3, sock, data, offset, 0);
-					bytes -= offset;
-
-					// then send icy data
-					send_data(ctx->http_length == -3, sock, buffer, len_16 * 16 + 1, 0);
-					ctx->icy.remain = ctx->icy.interval;
-
-					LOG_SDEBUG("[%p]: ICY checked %u", ctx, ctx->icy.remain);
-				} else {
-					offset = 0;
-					pthread_mutex_unlock(&ctx->ab_mutex);
-				}
+		// encoder runs once, all clients send from the cache
+		raop_cache_write(ctx->http_cache, data, bytes);
 
-				LOG_SDEBUG("[%p]: HTTP sent frame count:%u bytes:%u (W:%hu R:%hu)", ctx, frame_count++, bytes + offset, ctx->ab_write, ctx->ab_read);
-				ssize_t sent = send_data(ctx->http_length == -3, sock, data + offset , bytes, 0);
+		if (ctx->icy.enabled && ctx->icy.updated) http_icy_update(ctx);
+		count = raop_cache_count(ctx->http_cache);
 
-				// update remaining count with desired length
-				if (ctx->icy.active) ctx->icy.remain -= bytes;
-
-				gap = gettime_ms() - gap;
+		// release mutex here as send might take a while
+		pthread_mutex_unlock(&ctx->ab_mutex);
 
-				if (gap > 100) {
-					LOG_WARN("[%p]: spent %u ms in send for %u bytes (sent %zd)!", ctx, gap, bytes, sent);
-				}
+		LOG_SDEBUG("[%p]: HTTP sent frame count:%u bytes:%zu (W:%hu R:%hu)", ctx, ctx->out_frames, bytes, ctx->ab_write, ctx->ab_read);
 
-				if (sent != bytes) {
-					LOG_WARN("[%p]: HTTP send() unexpected response: %li (data=%i): %s", ctx, (long int) sent, bytes, strerror(errno));
-				}
-			} else pthread_mutex_unlock(&ctx->ab_mutex);
+		start = gettime_local_us();
 
-			// no wait if we have more to send (catch-up) or just 1 frame in pause mode
-			timeout.tv_usec = ctx->pause ? (ctx->frame_size*1000000)/44100 : 0;
-		} else {
-			// nothing to send, so probably can wait 2 frame unless paused
-			timeout.tv_usec = (2*ctx->frame_size*1000000)/44100;
-			pthread_mutex_unlock(&ctx->ab_mutex);
+		for (int i = 0; i < MAX_HTTP_CLIENTS; i++) {
+			http_client_t *client = ctx->http_clients + i;
+			if (client->ready && !http_client_send(ctx, client, count)) http_close(ctx, client);
 		}
+
+		raop_hist_add(ctx->stats + STAT(http_stall), gettime_local_us() - start);
+
+		// no wait if we have more to send (catch-up) or just 1 frame in pause mode
+		next = ctx->pause ? (ctx->frame_size*1000000)/44100 : 0;
+	} else {
+		// a frame waited for is stale once no client is ready (flush, close...)
+		if (!ready) ctx->http_sched.waiting = false;
+
+		// nothing to send, wait for a request, for the frame or for its playtime
+		if (!ctx->http_sched.waiting) next = ready ? HTTP_ACCEPT_MS * 1000 : HTTP_IDLE_MS * 1000;
+		else if (ctx->http_sched.due) next = max((int32_t) (ctx->http_sched.playtime - gettime_ms()), 0) * 1000;
+		else next = HTTP_IDLE_MS * 1000;
+
+		// without event set, we won't be woken-up when data arrives
+		if (ctx->http_sched.efd < 0) next = min(next, (2*ctx->frame_size*1000000)/44100);
+
+		pthread_mutex_unlock(&ctx->ab_mutex);
 	}
 
-	if (sock != -1) shutdown_socket(sock);
+	return next;
+}
+
+/*---------------------------------------------------------------------------*/
+static void *http_thread_func(void *arg) {
+	raopst_t *ctx = (raopst_t*) arg;
+	uint32_t wait = 0;
+
+	while (ctx->running) {
+#if LINUX
+		if (ctx->http_sched.efd >= 0) {
+			struct epoll_event ev;
+			if (epoll_wait(ctx->http_sched.efd, &ev, 1, -1) > 0) http_sched_run(ctx);
+			continue;
+		}
+#endif
+		wait = http_serve(ctx, wait);
+	}
 
 	LOG_INFO("[%p]: terminating", ctx);
 	return NULL;
 }
 
+/*---------------------------------------------------------------------------*/
+static void http_reactor_cb(void *owner, int fd) {
+	http_sched_run((raopst_t*) owner);
+}
+
+#if LINUX
+/*
+ HTTP listener and clients, a one-shot timer set to when next frame is due and
+ an eventfd written when that frame arrives (or on flush/exit) are in one epoll
+ set that can be waited on by a thread or be a single fd of a reactor
+*/
+
+/*---------------------------------------------------------------------------*/
+static bool http_sched_init(raopst_t *ctx) {
+	ctx->http_sched.efd = epoll_create1(EPOLL_CLOEXEC);
+	ctx->http_sched.timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	ctx->http_sched.wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	if (ctx->http_sched.efd < 0 || ctx->http_sched.timer < 0 || ctx->http_sched.wake < 0) {
+		LOG_WARN("[%p]: cannot create HTTP event set %s", ctx, strerror(errno));
+		http_sched_free(ctx);
+		return false;
+	}
+
+	http_sched_add(ctx, ctx->http_sched.timer);
+	http_sched_add(ctx, ctx->http_sched.wake);
+	http_sched_add(ctx, ctx->http_listener);
+
+	return true;
+}
+
+/*---------------------------------------------------------------------------*/
+static void http_sched_free(raopst_t *ctx) {
+	if (ctx->http_sched.efd >= 0) close(ctx->http_sched.efd);
+	if (ctx->http_sched.timer >= 0) close(ctx->http_sched.timer);
+	if (ctx->http_sched.wake >= 0) close(ctx->http_sched.wake);
+	ctx->http_sched.efd = ctx->http_sched.timer = ctx->http_sched.wake = -1;
+}
+
+/*---------------------------------------------------------------------------*/
+static void http_sched_add(raopst_t *ctx, int fd) {
+	struct epoll_event ev = { 0 };
+
+	if (ctx->http_sched.efd < 0) return;
+
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+	epoll_ctl(ctx->http_sched.efd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/*---------------------------------------------------------------------------*/
+static void http_sched_wake(raopst_t *ctx) {
+	uint64_t one = 1;
+	if (ctx->http_sched.wake >= 0 && write(ctx->http_sched.wake, &one, sizeof(one)) < 0) {
+		LOG_WARN("[%p]: cannot wake HTTP %s", ctx, strerror(errno));
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+static void http_sched_run(raopst_t *ctx) {
+	struct epoll_event events[MAX_HTTP_CLIENTS + 3];
+	struct itimerspec spec = { { 0, 0 }, { 0, 0 } };
+	uint32_t wait = 0;
+	uint64_t count;
+	bool clients = false;
+	int n = epoll_wait(ctx->http_sched.efd, events, MAX_HTTP_CLIENTS + 3, 0);
+
+	// just acknowledge, sockets are checked when serving and what to do is decided there
+	for (int i = 0; i < n; i++) {
+		int fd = events[i].data.fd;
+		if ((fd == ctx->http_sched.timer || fd == ctx->http_sched.wake) && read(fd, &count, sizeof(count)) < 0) count = 0;
+	}
+
+	// send all we can
+	while (ctx->running && !wait) wait = http_serve(ctx, 0);
+
+	for (int i = 0; i < MAX_HTTP_CLIENTS; i++) clients |= ctx->http_clients[i].sock != -1;
+
+	// one-shot, a zero value disarms the timer when only listener can wake us
+	if (clients) {
+		spec.it_value.tv_sec = wait / 1000000;
+		spec.it_value.tv_nsec = (wait % 1000000) * 1000;
+	}
+
+	timerfd_settime(ctx->http_sched.timer, 0, &spec, NULL);
+}
+
+#else
+
+/*---------------------------------------------------------------------------*/
+static bool http_sched_init(raopst_t *ctx) {
+	return false;
+}
+
+/*---------------------------------------------------------------------------*/
+static void http_sched_free(raopst_t *ctx) {
+}
+
+/*---------------------------------------------------------------------------*/
+static void http_sched_add(raopst_t *ctx, int fd) {
+}
+
+/*---------------------------------------------------------------------------*/
+static void http_sched_wake(raopst_t *ctx) {
+}
+
+/*---------------------------------------------------------------------------*/
+static void http_sched_run(raopst_t *ctx) {
+}
+
+#endif
+
 /*----------------------------------------------------------------------------*/
-static bool handle_http(raopst_t *ctx, int sock) {
+static bool handle_http(raopst_t *ctx, http_client_t *client) {
 	char *body = NULL, method[16] = "", proto[16] = "", *str, *head = NULL;
 	key_data_t headers[64], resp[16] = { { NULL, NULL } };
 	size_t offset = 0;
 	int len;
 
-	if (!http_parse(sock, method, NULL, proto, headers, &body, &len)) return false;
+	if (!http_parse(client->sock, method, NULL, proto, headers, &body, &len)) return false;
 	bool HTTP_11 = strstr(proto, "HTTP/1.1") != NULL;
 
+	// chunked is only possible with HTTP/1.1 clients
+	client->chunked = ctx->http_length == -3 && HTTP_11;
+
 	if (*loglevel >= lINFO) {
 		char *p = kd_dump(headers);
 		LOG_INFO("[%p]: received %s %s\n%s", ctx, method, proto, p);
@@ -1109,34 +1950,36 @@ static bool handle_http(raopst_t *ctx, int sock) {
 		sscanf(str, "bytes=%zu", &offset);
 #endif	
 		if (offset) {
-			// try to find the position in the memorized data
-			offset = (ctx->http_count && ctx->http_count > CACHE_SIZE) ? min(offset, ctx->http_count - CACHE_SIZE - 1) : 0;
-			head = (ctx->http_length == -3 && HTTP_11) ? "HTTP/1.1 206 Partial Content" : "HTTP/1.0 206 Partial Content";
-			kd_vadd(resp, "Content-Range", "bytes %zu-%zu/*", offset, ctx->http_count);
+			size_t start = raop_cache_start(ctx->http_cache), count = raop_cache_count(ctx->http_cache);
+			// exact position when still in cache, otherwise closest bound, which is on a frame
+			offset = min(max(offset, start), count);
+			head = client->chunked ? "HTTP/1.1 206 Partial Content" : "HTTP/1.0 206 Partial Content";
+			kd_vadd(resp, "Content-Range", "bytes %zu-%zu/*", offset, count);
 		}
 	}
 
 	// check if add ICY metadata is needed (only on live stream)
 	if (ctx->icy.enabled &&	((str = kd_lookup(headers, "Icy-MetaData")) != NULL) && atoi(str)) {
 		kd_vadd(resp, "icy-metaint", "%u", ctx->icy.interval);
-		ctx->icy.remain = ctx->icy.interval;
-		ctx->icy.active = true;
-	} else ctx->icy.active = false;
+		client->icy.remain = ctx->icy.interval;
+		client->icy.version = ctx->icy.version;
+		client->icy.active = true;
+	} else client->icy.active = false;
 
 	// let owner modify HTTP response if needed
 	if (ctx->http_cb) ctx->http_cb(ctx->owner, headers, resp);
 
-	if (ctx->http_length == -3 && HTTP_11) {
+	if (client->chunked) {
 		char *value = kd_lookup(headers, "Connection");
 		if (value && (!strcasecmp(value, "close") || !strcasecmp(value,"keep-alive"))) kd_add(resp, "Connection", value);
 		else kd_add(resp, "Connection", "close");
 		kd_add(resp, "Transfer-Encoding", "chunked");
-		str = http_send(sock, head ? head : "HTTP/1.1 200 OK", resp);
+		str = http_send(client->sock, head ? head : "HTTP/1.1 200 OK", resp);
 	} else {
 		// content-length is only for current payload, so ignore it with range 
 		if (ctx->http_length > 0 && !offset) kd_vadd(resp, "Content-Length", "%d", ctx->http_length);
 		kd_add(resp, "Connection", "close");
-		str = http_send(sock, head ? head : "HTTP/1.0 200 OK", resp);
+		str = http_send(client->sock, head ? head : "HTTP/1.0 200 OK", resp);
 	}
 
 	LOG_INFO("[%p]: responding: %s", ctx, str);
@@ -1149,35 +1992,13 @@ static bool handle_http(raopst_t *ctx, int sock) {
 	// nothing else to do if this is a HEAD request
 	if (strstr(method, "HEAD")) return false;
 
-	// need to re-send the range or restart from as far as possible on simple GET
-	if (offset || (ctx->http_count && ctx->http_count <= CACHE_SIZE)) {
-		size_t count = 0;
+	// re-send the range or from the beginning on simple GET if still in cache, then continue live
+	if (offset) client->pos = offset;
+	else client->pos = raop_cache_start(ctx->http_cache) ? raop_cache_count(ctx->http_cache) : 0;
 
-		LOG_INFO("[%p] re-sending bytes %zu-%zu", ctx, offset, ctx->http_count);
+	if (client->pos < raop_cache_count(ctx->http_cache)) {
+		LOG_INFO("[%p] re-sending bytes %zu-%zu", ctx, client->pos, raop_cache_count(ctx->http_cache));
 		ctx->silence_count = 0;
-		while (count != ctx->http_count - offset) {
-			size_t bytes = ctx->icy.active ? ctx->icy.remain : 16384;
-			int sent;
-
-			bytes = min(bytes, ctx->http_count - offset - count);
-			sent = send_data(ctx->http_length == -3, sock, ctx->http_cache + ((offset + count) % CACHE_SIZE), bytes, 0);
-
-			if (sent < 0) {
-				LOG_ERROR("[%p]: error re-sending range %u", ctx, offset);
-				break;
-			}
-
-			count += sent;
-
-			// send ICY data if needed
-			if (ctx->icy.active) {
-				ctx->icy.remain -= sent;
-				if (!ctx->icy.remain) {
-					send_data(ctx->http_length == -3, sock, "", 1, 0);
-					ctx->icy.remain = ctx->icy.interval;
-				}
-			}
-		}
 	}
 
 	return true;
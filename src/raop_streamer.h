@@ -28,8 +28,32 @@ raopst_resp_t 	raopst_init(struct in_addr host, struct in_addr peer, char *codec
 							void *owner, raopst_cb_t event_cb, raop_http_cb_t http_cb,
 							unsigned short port_base, unsigned short port_range,
 							int http_length);
+
+// resources that sessions can share, any can be NULL
+struct raop_reactor_s;
+struct raop_cache_pool_s;
+
+typedef struct {
+	struct raop_reactor_s *reactor;		// used instead of the RTP and HTTP threads
+	struct raop_cache_pool_s *cache;	// HTTP cache is taken from it (see raop_cache.h)
+} raopst_shared_t;
+
+// same as raopst_init, shared can be NULL
+raopst_resp_t 	raopst_init_ex(struct in_addr host, struct in_addr peer, char *codec, bool metadata,
+							   bool drift, bool range, char *latencies,
+							   char *aeskey, char *aesiv, char *fmtpstr,
+							   short unsigned pCtrlPort, short unsigned pTimingPort,
+							   void *owner, raopst_cb_t event_cb, raop_http_cb_t http_cb,
+							   unsigned short port_base, unsigned short port_range,
+							   int http_length, raopst_shared_t *shared);
 void			 	raopst_end(struct raopst_s *ctx);
 bool 				raopst_flush(struct raopst_s *ctx, unsigned short seqno, unsigned rtptime, bool exit_locked, bool silence);
 void 				raopst_flush_release(struct raopst_s *ctx);
 void 				raopst_record(struct raopst_s *ctx, unsigned short seqno, unsigned rtptime);
 void 				raopst_metadata(struct raopst_s *ctx, raopsr_metadata_t *metadata);
+// RTP hold depth, adaptive mode sizes it from jitter, resend recovery and HTTP lag up to ms (0 is sender's)
+// it's applied at next sync packet and can be set from any thread, even holding streamer's lock (event_cb)
+void 				raopst_set_latency(struct raopst_s *ctx, int ms, bool adaptive);
+int 				raopst_get_latency(struct raopst_s *ctx);
+// lock-free snapshot, each value is consistent but not the set
+bool 				raopst_stats(struct raopst_s *ctx, raop_stats_t *stats);